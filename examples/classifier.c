@@ -50,6 +50,12 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char *tree = option_find_str(options, "tree", 0);
     if (tree) net->hierarchy = read_tree(tree);
     int classes = option_find_int(options, "classes", 2);
+    int prefetch = option_find_int_quiet(options, "prefetch", 2);  // 训练时提前加载的 batch 个数
+    int image_cache = option_find_int_quiet(options, "image_cache", 0);  // 解码后图片缓存的大小(MB)，0表示不缓存
+    set_image_cache_size((size_t)image_cache*1024*1024);
+    int shuffle = option_find_int_quiet(options, "shuffle", 1);  // 按 epoch 打乱后无放回地取样本，为0时每次有放回地随机抽取
+    int world = option_find_int_quiet(options, "world", 1);      // 多进程训练时的进程数和本进程的序号，各进程需要设置相同的 seed
+    int rank = option_find_int_quiet(options, "rank", 0);
 
     char **labels = 0;
     if(!tag){
@@ -87,12 +93,10 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     } else {
         args.type = CLASSIFICATION_DATA;
     }
+    if(shuffle) args.sampler = make_sampler(N, rank, world, option_find_int_quiet(options, "seed", world > 1 ? 0 : rand()));
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, prefetch + 1);
 
     int count = 0;
     int epoch = (*net->seen)/N;
@@ -110,10 +114,8 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
             args.max = net->max_ratio*dim;
             printf("%d %d\n", args.min, args.max);
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            free_data_loader(loader);
+            loader = make_data_loader(args, prefetch + 1);
 
             for(i = 0; i < ngpus; ++i){
                 resize_network(nets[i], dim, dim);
@@ -122,11 +124,16 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         }
         time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = data_loader_next(loader);
 
-        printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
+        int loaded, stalls;
+        data_loader_stats(loader, &loaded, &stalls, 0);
+        printf("Loaded: %lf seconds, stalled %d of %d batches\n", what_time_is_it_now()-time, stalls, loaded);
+        if(image_cache){
+            size_t hits, misses, bytes;
+            image_cache_stats(&hits, &misses, &bytes);
+            printf("Image cache: %.1f%% hits, %.1f MB\n", 100.*hits/(hits + misses + !(hits + misses)), bytes/1048576.);
+        }
         time = what_time_is_it_now();
 
         float loss = 0;
@@ -142,7 +149,6 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net->seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net->seen);
-        free_data(train);
         if(*net->seen/N > epoch){
             epoch = *net->seen/N;
             char buff[256];
@@ -158,7 +164,8 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     sprintf(buff, "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
-    pthread_join(load_thread, 0);
+    free_data_loader(loader);
+    if(args.sampler) free_sampler(args.sampler);
 
     free_network(net);
     if(labels) free_ptrs((void**)labels, classes);
@@ -0,0 +1,35 @@
+#include "darknet.h"
+
+/*
+数据集预处理工具：
+    darknet dataset pack <train.list> <输出前缀> [-per N] [-max D]
+把训练图片和标签打包成分片文件，见 pack_detection_shards
+    darknet dataset labels <train.list> [索引文件]
+把训练图片的标签写成二进制索引(默认为 <train.list>.labels)，在 .data 中用 label_index= 指定之后训练时直接读入，
+见 load_label_set。索引不会检查标签文本是否修改过，修改标签之后需要重新生成
+*/
+void run_dataset(int argc, char **argv)
+{
+    int per = find_int_arg(argc, argv, "-per", 10000);
+    int max = find_int_arg(argc, argv, "-max", 0);
+    // find_int_arg 把选项和它的值从 argv 中删掉，末尾补0，剩下的参数个数要重新数
+    while(argc > 0 && !argv[argc-1]) --argc;
+    if(argc < 4 || (0==strcmp(argv[2], "pack") && argc < 5)){
+        fprintf(stderr, "usage: %s %s pack [train list] [output prefix] [-per images per shard] [-max max image side]\n", argv[0], argv[1]);
+        fprintf(stderr, "       %s %s labels [train list] [index file]\n", argv[0], argv[1]);
+        return;
+    }
+    if(0==strcmp(argv[2], "pack")) pack_detection_shards(argv[3], argv[4], per, max);
+    else if(0==strcmp(argv[2], "labels")){
+        list *plist = get_paths(argv[3]);
+        char **paths = (char **)list_to_array(plist);
+        char index_file[4096];
+        if(argc > 4) snprintf(index_file, sizeof(index_file), "%s", argv[4]);
+        else snprintf(index_file, sizeof(index_file), "%s.labels", argv[3]);
+        label_set *labels = load_label_set(paths, plist->size, 0);
+        save_label_set(labels, index_file);
+        free_label_set(labels);
+        free_ptrs((void **)paths, plist->size);
+        free_list(plist);
+    }
+}
@@ -1,5 +1,13 @@
 #include "darknet.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 static int coco_ids[] = {1,2,3,4,5,6,7,8,9,10,11,13,14,15,16,17,18,19,20,21,22,23,24,25,27,28,31,32,33,34,35,36,37,38,39,40,41,42,43,44,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,67,70,72,73,74,75,76,77,78,79,80,81,82,84,85,86,87,88,89,90};
 
 
@@ -8,6 +16,15 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     list *options = read_data_cfg(datacfg);
     char *train_images = option_find_str(options, "train", "data/train.list");
     char *backup_directory = option_find_str(options, "backup", "/backup/");
+    char *shard_list = option_find_str(options, "shards", 0);  // darknet dataset pack 生成的分片列表，设置时不再读取 train 中的图片
+    int prefetch = option_find_int_quiet(options, "prefetch", 2);  // 训练时提前加载的 batch 个数
+    int image_cache = option_find_int_quiet(options, "image_cache", 0);  // 解码后图片缓存的大小(MB)，0表示不缓存
+    set_image_cache_size((size_t)image_cache*1024*1024);
+    int shuffle = option_find_int_quiet(options, "shuffle", 1);  // 按 epoch 打乱后无放回地取样本，为0时每次有放回地随机抽取
+    int world = option_find_int_quiet(options, "world", 1);      // 多进程训练时的进程数和本进程的序号，各进程需要设置相同的 seed
+    int rank = option_find_int_quiet(options, "rank", 0);
+    int label_cache = option_find_int_quiet(options, "label_cache", 1);  // 训练开始时一次读入所有标签，为0时每个样本都读取标签文件
+    char *label_index = option_find_str(options, "label_index", 0);  // darknet dataset labels 生成的索引，标签文本修改之后需要重新生成
 
     srand(time(0));
     char *base = basecfg(cfgfile);
@@ -31,31 +48,47 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 
     int imgs = net->batch * net->subdivisions * ngpus;
     printf("Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
-    data train, buffer;
+    data train;
 
     layer l = net->layers[net->n - 1];
 
     int classes = l.classes;
     float jitter = l.jitter;
 
-    list *plist = get_paths(train_images);
-    //int N = plist->size;
-    char **paths = (char **)list_to_array(plist);
+    list *plist = 0;
+    char **paths = 0;
+    if(!shard_list){
+        plist = get_paths(train_images);
+        //int N = plist->size;
+        paths = (char **)list_to_array(plist);
+    }
+    label_set *labels = 0;
+    if(!shard_list && label_cache){
+        // 只有在 .data 中指定了索引时才读入，否则读取标签文本，避免标签修改之后使用过期的索引
+        labels = load_label_set(paths, plist->size, label_index);
+    }
 
     load_args args = get_base_args(net);
     args.coords = l.coords;
     args.paths = paths;
     args.n = imgs;
-    args.m = plist->size;
+    args.m = plist ? plist->size : 0;
+    args.label_set = labels;
     args.classes = classes;
     args.jitter = jitter;
     args.num_boxes = l.max_boxes;
-    args.d = &buffer;
     args.type = DETECTION_DATA;
     //args.type = INSTANCE_DATA;
     args.threads = 64;
+    if(shard_list){
+        args.shards = open_shard_list(shard_list);
+        args.type = SHARD_DETECTION_DATA;
+    }
+    if(shuffle){
+        args.sampler = make_sampler(args.shards ? shard_count(args.shards) : args.m, rank, world, option_find_int_quiet(options, "seed", world > 1 ? 0 : rand()));
+    }
 
-    pthread_t load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, prefetch + 1);
     double time;
     int count = 0;
     //while(i*imgs < N*120){
@@ -69,10 +102,8 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             args.w = dim;
             args.h = dim;
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            free_data_loader(loader);
+            loader = make_data_loader(args, prefetch + 1);
 
             #pragma omp parallel for
             for(i = 0; i < ngpus; ++i){
@@ -81,9 +112,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             net = nets[0];
         }
         time=what_time_is_it_now();
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = data_loader_next(loader);
 
         /*
            int k;
@@ -109,7 +138,14 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
            }
          */
 
-        printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
+        int loaded, stalls;
+        data_loader_stats(loader, &loaded, &stalls, 0);
+        printf("Loaded: %lf seconds, stalled %d of %d batches\n", what_time_is_it_now()-time, stalls, loaded);
+        if(image_cache){
+            size_t hits, misses, bytes;
+            image_cache_stats(&hits, &misses, &bytes);
+            printf("Image cache: %.1f%% hits, %.1f MB\n", 100.*hits/(hits + misses + !(hits + misses)), bytes/1048576.);
+        }
 
         time=what_time_is_it_now();
         float loss = 0;
@@ -143,8 +179,11 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             sprintf(buff, "%s/%s_%d.weights", backup_directory, base, i);
             save_weights(net, buff);
         }
-        free_data(train);
     }
+    free_data_loader(loader);
+    if(args.shards) free_shards(args.shards);
+    if(args.sampler) free_sampler(args.sampler);
+    free_label_set(labels);
 #ifdef GPU
     if(ngpus != 1) sync_nets(nets, ngpus, 0);
 #endif
@@ -293,6 +332,8 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     image *val_resized = calloc(nthreads, sizeof(image));
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
+    int *val_size = calloc(2*nthreads, sizeof(int));  // 原图的宽和高，val 可能是按缩小的比例解码的
+    int *buf_size = calloc(2*nthreads, sizeof(int));
     pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
 
     image input = make_image(net->w, net->h, net->c*2);
@@ -307,6 +348,7 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
         args.path = paths[i+t];
         args.im = &buf[t];
         args.resized = &buf_resized[t];
+        args.im_size = buf_size + 2*t;
         thr[t] = load_data_in_thread(args);
     }
     double start = what_time_is_it_now();
@@ -316,11 +358,14 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
             pthread_join(thr[t], 0);
             val[t] = buf[t];
             val_resized[t] = buf_resized[t];
+            val_size[2*t] = buf_size[2*t];
+            val_size[2*t+1] = buf_size[2*t+1];
         }
         for(t = 0; t < nthreads && i+t < m; ++t){
             args.path = paths[i+t];
             args.im = &buf[t];
             args.resized = &buf_resized[t];
+            args.im_size = buf_size + 2*t;
             thr[t] = load_data_in_thread(args);
         }
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
@@ -331,11 +376,12 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
             copy_cpu(net->w*net->h*net->c, val_resized[t].data, 1, input.data + net->w*net->h*net->c, 1);
 
             network_predict(net, input.data);
-            int w = val[t].w;
-            int h = val[t].h;
-            int num = 0;
-            detection *dets = get_network_boxes(net, w, h, thresh, .5, map, 0, &num);
-            if (nms) do_nms_sort(dets, num, classes, nms);
+            int w = val_size[2*t];
+            int h = val_size[2*t+1];
+            detection_batch *b = get_network_detections(net, w, h, thresh, .5, map, 0);
+            if (nms) do_nms_sort_batch(b, nms);
+            detection *dets = detection_batch_dets(b);
+            int num = b->n;
             if (coco){
                 print_cocos(fp, path, dets, num, classes, w, h);
             } else if (imagenet){
@@ -343,7 +389,6 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
             } else {
                 print_detector_detections(fps, id, dets, num, classes, w, h);
             }
-            free_detections(dets, num);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -424,6 +469,8 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     image *val_resized = calloc(nthreads, sizeof(image));
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
+    int *val_size = calloc(2*nthreads, sizeof(int));  // 原图的宽和高，val 可能是按缩小的比例解码的
+    int *buf_size = calloc(2*nthreads, sizeof(int));
     pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
 
     load_args args = {0};
@@ -436,6 +483,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
         args.path = paths[i+t];
         args.im = &buf[t];
         args.resized = &buf_resized[t];
+        args.im_size = buf_size + 2*t;
         thr[t] = load_data_in_thread(args);
     }
     double start = what_time_is_it_now();
@@ -445,11 +493,14 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             pthread_join(thr[t], 0);
             val[t] = buf[t];
             val_resized[t] = buf_resized[t];
+            val_size[2*t] = buf_size[2*t];
+            val_size[2*t+1] = buf_size[2*t+1];
         }
         for(t = 0; t < nthreads && i+t < m; ++t){
             args.path = paths[i+t];
             args.im = &buf[t];
             args.resized = &buf_resized[t];
+            args.im_size = buf_size + 2*t;
             thr[t] = load_data_in_thread(args);
         }
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
@@ -457,11 +508,12 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             char *id = basecfg(path);
             float *X = val_resized[t].data;
             network_predict(net, X);
-            int w = val[t].w;
-            int h = val[t].h;
-            int nboxes = 0;
-            detection *dets = get_network_boxes(net, w, h, thresh, .5, map, 0, &nboxes);
-            if (nms) do_nms_sort(dets, nboxes, classes, nms);
+            int w = val_size[2*t];
+            int h = val_size[2*t+1];
+            detection_batch *b = get_network_detections(net, w, h, thresh, .5, map, 0);
+            if (nms) do_nms_sort_batch(b, nms);
+            detection *dets = detection_batch_dets(b);
+            int nboxes = b->n;
             if (coco){
                 print_cocos(fp, path, dets, nboxes, classes, w, h);
             } else if (imagenet){
@@ -469,7 +521,6 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             } else {
                 print_detector_detections(fps, id, dets, nboxes, classes, w, h);
             }
-            free_detections(dets, nboxes);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -583,6 +634,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
             if(!input) return;
             strtok(input, "\n");
         }
+        // 检测框画在原图上并保存，这里需要原始分辨率，不用 load_image_reduced
         image im = load_image_color(input,0,0);
         image sized = letterbox_image(im, net->w, net->h);
         //image sized = resize_image(im, net->w, net->h);
@@ -775,6 +827,278 @@ void extract_detector(char *datacfg, char *cfgfile, char *weightfile, int cam_in
 }
 */
 
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_LINE 4096
+
+typedef struct{
+    int fd;                  // 客户端连接，stdin 模式下为0，-1 表示空闲
+    int out;                 // 回复写入的文件描述符
+    int generation;          // 每次有新连接使用这个位置时加1，区分前后两个不同的连接
+    int len;
+    char buf[SERVE_LINE];    // 尚未读到换行符的部分
+} serve_client;
+
+typedef struct{
+    serve_client *client;
+    int generation;          // 提交请求时 client 的 generation，不一致说明原来的连接已经断开
+    char *path;
+    image_u8 im;             // 输入图片(uint8)，可能是按缩小的比例解码的
+    int w, h;                // 原图的大小，用于把检测框还原到原图尺寸
+} serve_request;
+
+/*
+输入：文件描述符 fd，要写的 n 个字节 buf
+功能：把回复全部写给客户端。客户端已经断开(EPIPE)，或者一直不读结果、发送缓冲区满了(EAGAIN)时放弃，
+     不能让一个客户端阻塞整个服务
+返回：写完返回1，失败返回0，调用者应断开这个客户端
+*/
+static int serve_write(int fd, char *buf, size_t n)
+{
+    while(n > 0){
+        ssize_t w = write(fd, buf, n);
+        if(w <= 0){
+            if(w < 0 && errno == EINTR) continue;
+            return 0;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 1;
+}
+
+// 断开客户端，之后到达的结果都被丢弃。stdin 模式的 fd 0 不关闭，置为-1后服务退出
+static void serve_drop(serve_client *c)
+{
+    if(c->fd > 0) close(c->fd);
+    c->fd = -1;
+}
+
+/*
+输入：网络 net，当前凑齐的 n 个请求 reqs，网络输入 X，类别名 names
+功能：把 n 个请求的图片放进同一批做一次前向计算，再把每个样本的检测结果写回发出请求的客户端。
+     每个请求的回复为一行 "路径: 检测框个数"，然后每个检测框一行 "类别 置信度 left top right bottom"(原图像素坐标)，最后是一个空行
+*/
+static void serve_batch(network *net, serve_request *reqs, int n, float *X, char **names, float thresh, float hier_thresh, float nms)
+{
+    int b, i, j;
+    layer l = net->layers[net->n-1];
+    for(b = 0; b < n; ++b){
+        // 缩放在 uint8 上完成，写入网络输入时才转换成 float
+        image_u8 sized = letterbox_image_u8(reqs[b].im, net->w, net->h);
+        image_u8_to_float(sized, X + (size_t)b*net->inputs);
+        free_image_u8(sized);
+    }
+    double time = what_time_is_it_now();
+    network_predict(net, X);
+    fprintf(stderr, "Served batch of %d in %f seconds.\n", n, what_time_is_it_now() - time);
+
+    int *w = calloc(n, sizeof(int));
+    int *h = calloc(n, sizeof(int));
+    for(b = 0; b < n; ++b){
+        w[b] = reqs[b].w;
+        h[b] = reqs[b].h;
+    }
+    detection_batch *batches = get_network_detections_batch(net, n, w, h, thresh, hier_thresh, 0, 1, nms);
+    free(w);
+    free(h);
+
+    size_t cap = 4096;
+    char *out = calloc(cap, 1);
+    for(b = 0; b < n; ++b){
+        serve_request r = reqs[b];
+        detection_batch *batch = batches + b;
+        detection *dets = detection_batch_dets(batch);
+        int nboxes = batch->n;
+        size_t len = 0;
+        int count = 0;
+        for(i = 0; i < nboxes; ++i){
+            for(j = 0; j < l.classes; ++j) if(dets[i].prob[j] > thresh) ++count;
+        }
+        len += snprintf(out + len, cap - len, "%s: %d\n", r.path, count);
+        for(i = 0; i < nboxes; ++i){
+            box bb = dets[i].bbox;
+            float left  = (bb.x - bb.w/2.)*r.w;
+            float right = (bb.x + bb.w/2.)*r.w;
+            float top   = (bb.y - bb.h/2.)*r.h;
+            float bot   = (bb.y + bb.h/2.)*r.h;
+            for(j = 0; j < l.classes; ++j){
+                if(dets[i].prob[j] <= thresh) continue;
+                if(cap - len < 512){
+                    cap *= 2;
+                    out = realloc(out, cap);
+                }
+                len += snprintf(out + len, cap - len, "%s %f %.1f %.1f %.1f %.1f\n", names[j], dets[i].prob[j], left, top, right, bot);
+            }
+        }
+        len += snprintf(out + len, cap - len, "\n");
+        // 原来的连接已经断开(位置可能已经给了新的连接)时丢弃结果
+        if(r.client->fd >= 0 && r.client->generation == r.generation && !serve_write(r.client->out, out, len)) serve_drop(r.client);
+        free_image_u8(r.im);
+        free(r.path);
+    }
+    free(out);
+}
+
+static int serve_listen(char *socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) error("Socket path is too long");
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) error("Couldn't create socket");
+    unlink(socket_path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) error("Couldn't bind socket");
+    if(listen(fd, SERVE_MAX_CLIENTS) < 0) error("Couldn't listen on socket");
+    return fd;
+}
+
+/*
+输入：数据配置文件，网络配置和权重，socket_path 为0时从 stdin 读取请求，结果写到 stdout，
+     latency 为一个请求最多等待凑批的时间(毫秒)
+功能：检测服务。每个请求是一行图片路径，到达的请求在 latency 毫秒之内凑成最多 net->batch 个一批，
+     做一次前向计算之后把各自的检测结果写回对应的客户端。批的大小由网络配置文件中的 batch 决定
+*/
+void serve_detector(char *datacfg, char *cfgfile, char *weightfile, char *socket_path, float thresh, float hier_thresh, int latency)
+{
+    list *options = read_data_cfg(datacfg);
+    char *name_list = option_find_str(options, "names", "data/names.list");
+    char **names = get_labels(name_list);
+
+    // 客户端断开后再写回复会收到 SIGPIPE，默认处理是结束进程；忽略它，让 write 返回 EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    network *net = load_network_inference(cfgfile, weightfile);
+    int batch = net->batch;
+    float nms = .45;
+    float *X = calloc((size_t)batch*net->inputs, sizeof(float));
+    serve_request *reqs = calloc(batch, sizeof(serve_request));
+    int nreqs = 0;
+    double deadline = 0;
+
+    serve_client *clients = calloc(SERVE_MAX_CLIENTS, sizeof(serve_client));
+    struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+    int i;
+    for(i = 0; i < SERVE_MAX_CLIENTS; ++i) clients[i].fd = -1;
+    int listen_fd = -1;
+    if(socket_path){
+        listen_fd = serve_listen(socket_path);
+        fprintf(stderr, "Serving on %s, batch %d, latency %d ms\n", socket_path, batch, latency);
+    } else {
+        clients[0].fd = 0;
+        clients[0].out = 1;
+        fprintf(stderr, "Serving on stdin, batch %d, latency %d ms\n", batch, latency);
+    }
+
+    int running = 1;
+    while(running || nreqs){
+        int nfds = 0;
+        if(listen_fd >= 0){
+            fds[nfds].fd = listen_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        for(i = 0; i < SERVE_MAX_CLIENTS; ++i){
+            if(clients[i].fd < 0) continue;
+            fds[nfds].fd = clients[i].fd;
+            fds[nfds++].events = POLLIN;
+        }
+        int timeout = -1;
+        if(nreqs){
+            timeout = (int)((deadline - what_time_is_it_now())*1000);
+            if(timeout < 0) timeout = 0;
+        }
+        if(!running) nfds = 0;
+        if(poll(fds, nfds, timeout) < 0 && errno != EINTR) error("poll failed");
+
+        for(i = 0; i < nfds; ++i){
+            if(!fds[i].revents) continue;
+            if(fds[i].fd == listen_fd){
+                int fd = accept(listen_fd, 0, 0);
+                if(fd < 0) continue;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);  // 不读结果的客户端不能阻塞服务
+                int k;
+                for(k = 0; k < SERVE_MAX_CLIENTS && clients[k].fd >= 0; ++k);
+                if(k == SERVE_MAX_CLIENTS){
+                    close(fd);
+                    continue;
+                }
+                clients[k].fd = fd;
+                clients[k].out = fd;
+                clients[k].len = 0;
+                ++clients[k].generation;
+                continue;
+            }
+            serve_client *c = 0;
+            int k;
+            for(k = 0; k < SERVE_MAX_CLIENTS; ++k) if(clients[k].fd == fds[i].fd) c = clients + k;
+            if(!c) continue;
+            ssize_t r = read(c->fd, c->buf + c->len, SERVE_LINE - 1 - c->len);
+            if(r <= 0){
+                if(r < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                // 断开之前已经提交的请求仍然会计算，但结果被丢弃
+                if(c->fd > 0){
+                    serve_drop(c);
+                } else {
+                    running = 0;  // stdin 结束，处理完剩下的请求后退出
+                }
+                continue;
+            }
+            c->len += r;
+            c->buf[c->len] = 0;
+            char *line = c->buf;
+            char *end;
+            while(c->fd >= 0 && (end = strchr(line, '\n'))){
+                *end = 0;
+                strip(line);
+                if(line[0]){
+                    // 读不了或者不是图片的文件只回复错误，不能让服务退出
+                    image_u8 im = {0};
+                    int w = 0, h = 0;
+                    if(access(line, R_OK) == 0) im = try_load_image_u8_reduced(line, net->w, net->h, 3, &w, &h);
+                    if(!im.data){
+                        char msg[SERVE_LINE + 32];
+                        int n = snprintf(msg, sizeof(msg), "%s: error\n\n", line);
+                        if(!serve_write(c->out, msg, n)) serve_drop(c);
+                    } else {
+                        if(!nreqs) deadline = what_time_is_it_now() + latency/1000.;
+                        reqs[nreqs].client = c;
+                        reqs[nreqs].generation = c->generation;
+                        reqs[nreqs].path = calloc(strlen(line) + 1, sizeof(char));
+                        strcpy(reqs[nreqs].path, line);
+                        reqs[nreqs].im = im;
+                        reqs[nreqs].w = w;
+                        reqs[nreqs].h = h;
+                        ++nreqs;
+                        if(nreqs == batch){
+                            serve_batch(net, reqs, nreqs, X, names, thresh, hier_thresh, nms);
+                            nreqs = 0;
+                        }
+                    }
+                }
+                line = end + 1;
+            }
+            if(c->fd < 0) continue;
+            c->len = strlen(line);
+            memmove(c->buf, line, c->len + 1);
+            if(c->len == SERVE_LINE - 1) c->len = 0;  // 一行太长，丢弃
+        }
+        if(nreqs && (!running || what_time_is_it_now() >= deadline)){
+            serve_batch(net, reqs, nreqs, X, names, thresh, hier_thresh, nms);
+            nreqs = 0;
+        }
+        if(!socket_path && clients[0].fd < 0) running = 0;  // stdout 已经关闭
+    }
+    if(listen_fd >= 0){
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    free(clients);
+    free(reqs);
+    free(X);
+    free_network(net);
+}
+
 /*
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets)
 {
@@ -795,7 +1119,7 @@ void run_detector(int argc, char **argv)
     int frame_skip = find_int_arg(argc, argv, "-s", 0);
     int avg = find_int_arg(argc, argv, "-avg", 3);
     if(argc < 4){
-        fprintf(stderr, "usage: %s %s [train/test/valid] [cfg] [weights (optional)]\n", argv[0], argv[1]);
+        fprintf(stderr, "usage: %s %s [train/test/valid/serve] [cfg] [weights (optional)]\n", argv[0], argv[1]);
         return;
     }
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
@@ -827,6 +1151,8 @@ void run_detector(int argc, char **argv)
     int width = find_int_arg(argc, argv, "-w", 0);
     int height = find_int_arg(argc, argv, "-h", 0);
     int fps = find_int_arg(argc, argv, "-fps", 0);
+    char *socket_path = find_char_arg(argc, argv, "-socket", 0);
+    int latency = find_int_arg(argc, argv, "-latency", 10);
     //int class = find_int_arg(argc, argv, "-class", 0);
 
     char *datacfg = argv[3];
@@ -838,6 +1164,7 @@ void run_detector(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
+    else if(0==strcmp(argv[2], "serve")) serve_detector(datacfg, cfg, weights, socket_path, thresh, hier_thresh, latency);
     else if(0==strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
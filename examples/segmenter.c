@@ -37,6 +37,10 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
 
     char *backup_directory = option_find_str(options, "backup", "/backup/");
     char *train_list = option_find_str(options, "train", "data/train.list");
+    int prefetch = option_find_int_quiet(options, "prefetch", 2);  // 训练时提前加载的 batch 个数
+    int shuffle = option_find_int_quiet(options, "shuffle", 1);  // 按 epoch 打乱后无放回地取样本，为0时每次有放回地随机抽取
+    int world = option_find_int_quiet(options, "world", 1);      // 多进程训练时的进程数和本进程的序号，各进程需要设置相同的 seed
+    int rank = option_find_int_quiet(options, "rank", 0);
 
     list *plist = get_paths(train_list);
     char **paths = (char **)list_to_array(plist);
@@ -63,22 +67,20 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.n = imgs;
     args.m = N;
     args.type = SEGMENTATION_DATA;
+    if(shuffle) args.sampler = make_sampler(N, rank, world, option_find_int_quiet(options, "seed", world > 1 ? 0 : rand()));
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, prefetch + 1);
 
     int epoch = (*net->seen)/N;
     while(get_current_batch(net) < net->max_batches || net->max_batches == 0){
         double time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = data_loader_next(loader);
 
-        printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
+        int loaded, stalls;
+        data_loader_stats(loader, &loaded, &stalls, 0);
+        printf("Loaded: %lf seconds, stalled %d of %d batches\n", what_time_is_it_now()-time, stalls, loaded);
         time = what_time_is_it_now();
 
         float loss = 0;
@@ -105,7 +107,6 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net->seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net->seen);
-        free_data(train);
         if(*net->seen/N > epoch){
             epoch = *net->seen/N;
             char buff[256];
@@ -121,6 +122,8 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char buff[256];
     sprintf(buff, "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
+    free_data_loader(loader);
+    if(args.sampler) free_sampler(args.sampler);
 
     free_network(net);
     free_ptrs((void**)paths, plist->size);
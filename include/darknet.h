@@ -150,6 +150,8 @@ struct layer{
     int index;
     int binary;
     int xnor;
+    int implicit;    // 卷积层前向计算使用隐式gemm，不使用im2col工作空间
+    int winograd;    // 卷积层前向计算使用Winograd F(mxm,3x3)时的输出块大小m，为0表示不使用
     int steps;
     int hidden;
     int truth;
@@ -236,6 +238,7 @@ struct layer{
     float * scale_updates;
 
     float * weights;
+    float * winograd_weights;  // Winograd变换后的卷积核，由 transform_winograd_weights 根据 weights 计算
     float * weight_updates;
 
     float * delta;   // make_convolutional_layer中分配大小，存放 *ouuput 中所有的元素求梯度后的结果
@@ -473,6 +476,9 @@ typedef struct network{
     float saturation;
     float hue;
     int random;
+    int implicit;  // 所有卷积层默认是否使用隐式gemm，可以在每个卷积层中单独设置
+    int winograd;  // 所有3x3、步长为1的卷积层默认使用的Winograd输出块大小(0、2或4)，可以在每个卷积层中单独设置；-1 表示推理网络自动选择
+    int inference; // 以推理模式构建，各层没有分配反向传播和更新权重用的内存，不能训练
 
     int gpu_index;
     tree *hierarchy;
@@ -488,6 +494,11 @@ typedef struct network{
     （这些参数马上就会参与卷积运算），一旦用完，就会被马上更新（因此该变量的值的更新频率比较大）
     */
     float *workspace;
+    float *arena;  // plan_network_memory 规划之后，所有层的输出共用的一块内存
+    struct detection_batch *dets;  // get_network_detections 等复用的检测结果，每张图片一个
+    int ndets;                     // dets 的个数
+    void *weights_map;             // load_weights_mapped 映射的权重文件，各层的权重直接指向其中
+    size_t weights_map_size;       // 映射的大小
     int train;
     int index;
     float *cost;
@@ -502,6 +513,12 @@ typedef struct network{
 
 } network;
 
+// 网络的执行上下文：与 base 共享权重，各层输出、工作空间等前向计算时写入的内存私有，见 make_network_ctx
+typedef struct network_ctx{
+    network *base;
+    network net;
+} network_ctx;
+
 typedef struct {
     int w;
     int h;
@@ -519,6 +536,15 @@ typedef struct {
     float *data;
 } image;
 
+// 与 image 相同的排列(c*h*w)，每个像素一个字节，取值 [0,255]。
+// 解码、缩放、裁剪都可以直接在 uint8 上做，只在写入网络输入时转换成 [0,1] 的 float
+typedef struct {
+    int w;
+    int h;
+    int c;
+    unsigned char *data;
+} image_u8;
+
 typedef struct{
     float x, y, w, h;
 } box;
@@ -532,6 +558,26 @@ typedef struct detection{
     int sort_class;
 } detection;
 
+/*
+一张图片的检测结果，按结构数组(SoA)存放：检测框、objectness 各一个数组，类别概率为 size x classes 的矩阵。
+所有数组一次分配，在多帧之间重复使用，只在检测框变多时才重新分配。
+dets 是给使用 detection 的旧接口(do_nms_sort、draw_detections 等)准备的视图，由 detection_batch_dets 填写，
+其中的 prob、mask 直接指向矩阵中对应的行
+*/
+typedef struct detection_batch{
+    int n;              // 检测框个数
+    int size;           // 已经分配的个数
+    int classes;
+    int coords;
+    box *boxes;
+    float *objectness;
+    float *prob;        // 第 i 个检测框的类别概率为 prob + i*classes
+    float *mask;        // 第 i 个检测框的 mask 为 mask + i*(coords-4)，coords 不大于4时为0
+    detection *dets;
+    int *candidates;    // 解码时记录候选位置的临时空间
+    int candidates_size;
+} detection_batch;
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -548,9 +594,13 @@ typedef struct{
 } data;
 
 typedef enum {
-    CLASSIFICATION_DATA, DETECTION_DATA, CAPTCHA_DATA, REGION_DATA, IMAGE_DATA, COMPARE_DATA, WRITING_DATA, SWAG_DATA, TAG_DATA, OLD_CLASSIFICATION_DATA, STUDY_DATA, DET_DATA, SUPER_DATA, LETTERBOX_DATA, REGRESSION_DATA, SEGMENTATION_DATA, INSTANCE_DATA, ISEG_DATA
+    CLASSIFICATION_DATA, DETECTION_DATA, CAPTCHA_DATA, REGION_DATA, IMAGE_DATA, COMPARE_DATA, WRITING_DATA, SWAG_DATA, TAG_DATA, OLD_CLASSIFICATION_DATA, STUDY_DATA, DET_DATA, SUPER_DATA, LETTERBOX_DATA, REGRESSION_DATA, SEGMENTATION_DATA, INSTANCE_DATA, ISEG_DATA, SHARD_DETECTION_DATA
 } data_type;
 
+typedef struct shard_set shard_set;
+typedef struct sampler sampler;
+typedef struct label_set label_set;
+
 typedef struct load_args{
     int threads;
     char **paths;
@@ -580,8 +630,12 @@ typedef struct load_args{
     data *d;
     image *im;
     image *resized;
+    int *im_size;       // LETTERBOX_DATA：不为0时 *im 按缩小的比例解码(见 load_image_reduced)，原图的宽和高写入 im_size[0..1]
     data_type type;
     tree *hierarchy;
+    shard_set *shards;  // SHARD_DETECTION_DATA 使用的分片，见 open_shards
+    label_set *label_set;   // DETECTION_DATA：不为0时从预先读入的标签中取检测框(见 load_label_set)，不再逐个读取标签文件
+    sampler *sampler;   // 不为0时按 epoch 打乱的顺序无放回地取样本(见 make_sampler)，代替 get_random_paths 的有放回抽样
 } load_args;
 
 typedef struct{
@@ -592,6 +646,8 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *load_network_inference(char *cfg, char *weights);
+void plan_network_memory(network *net);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -609,6 +665,25 @@ typedef struct list{
 } list;
 
 pthread_t load_data(load_args args);
+typedef struct data_loader data_loader;
+data_loader *make_data_loader(load_args args, int depth);
+data data_loader_next(data_loader *dl);
+void data_loader_stats(data_loader *dl, int *count, int *stalls, double *stall_time);
+void set_image_cache_size(size_t bytes);
+void image_cache_stats(size_t *hits, size_t *misses, size_t *bytes);
+void free_data_loader(data_loader *dl);
+shard_set *open_shards(char **paths, int n);
+shard_set *open_shard_list(char *filename);
+void free_shards(shard_set *s);
+int shard_count(shard_set *s);
+void pack_detection_shards(char *train_list, char *prefix, int per_shard, int max_dim);
+sampler *make_sampler(int m, int rank, int world, unsigned int seed);
+void sampler_next(sampler *s, int *indexes, int n);
+int sampler_epoch(sampler *s);
+void free_sampler(sampler *s);
+label_set *load_label_set(char **paths, int n, char *index_file);
+void save_label_set(label_set *s, char *filename);
+void free_label_set(label_set *s);
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
 unsigned char *read_file(char *filename);
@@ -656,6 +731,7 @@ void draw_label(image a, int r, int c, image label, const float *rgb);
 void save_image(image im, const char *name);
 void save_image_options(image im, const char *name, IMTYPE f, int quality);
 void get_next_batch(data d, int n, int offset, float *X, float *y);
+void get_next_batch_view(data d, int n, int offset, float **X, float **y);
 void grayscale_image_3c(image im);
 void normalize_image(image p);
 void matrix_to_csv(matrix m);
@@ -687,8 +763,11 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_inference(char *filename);
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
+void load_weights_mapped(network *net, char *filename);
+void unmap_weights(network *net);
 void save_weights_upto(network *net, char *filename, int cutoff);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
 
@@ -706,6 +785,15 @@ void censor_image(image im, int dx, int dy, int w, int h);
 image letterbox_image(image im, int w, int h);
 image crop_image(image im, int dx, int dy, int w, int h);
 image center_crop_image(image im, int w, int h);
+image_u8 make_image_u8(int w, int h, int c);
+void free_image_u8(image_u8 m);
+image_u8 load_image_u8(char *filename, int w, int h, int c);
+image_u8 load_image_u8_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h);
+image_u8 try_load_image_u8_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h);
+image load_image_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h);
+image_u8 resize_image_u8(image_u8 im, int w, int h);
+image_u8 letterbox_image_u8(image_u8 im, int w, int h);
+void image_u8_to_float(image_u8 im, float *dst);
 image resize_min(image im, int min);
 image resize_max(image im, int max);
 image threshold_image(image im, float thresh);
@@ -745,6 +833,9 @@ matrix network_predict_data(network *net, data test);
 image **load_alphabet();
 image get_network_image(network *net);
 float *network_predict(network *net, float *input);
+network_ctx *make_network_ctx(network *net);
+float *network_predict_ctx(network_ctx *ctx, float *input);
+void free_network_ctx(network_ctx *ctx);
 
 int network_width(network *net);
 int network_height(network *net);
@@ -752,12 +843,19 @@ float *network_predict_image(network *net, image im);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets);
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
 void free_detections(detection *dets, int n);
+int decode_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection_batch *b);
+detection_batch *get_network_detections(network *net, int w, int h, float thresh, float hier, int *map, int relative);
+detection_batch *get_network_detections_batch(network *net, int n, int *w, int *h, float thresh, float hier, int *map, int relative, float nms);
+detection *detection_batch_dets(detection_batch *b);
+void free_detection_batch(detection_batch *b);
 
 void reset_network_state(network *net, int b);
 
 char **get_labels(char *filename);
 void do_nms_obj(detection *dets, int total, int classes, float thresh);
 void do_nms_sort(detection *dets, int total, int classes, float thresh);
+void do_nms_obj_batch(detection_batch *b, float thresh);
+void do_nms_sort_batch(detection_batch *b, float thresh);
 
 matrix make_matrix(int rows, int cols);
 
@@ -1,4 +1,5 @@
 #include "activations.h"
+#include "simd.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -113,6 +114,7 @@ float activate(float x, ACTIVATION a)
 void activate_array(float *x, const int n, const ACTIVATION a)
 {
     int i;
+    if(simd.activate && simd.activate(x, n, a)) return;  // 有向量化实现的激活函数直接返回
     for(i = 0; i < n; ++i){ // 对于要经过激活函数的矩阵中的每一个元素
         x[i] = activate(x[i], a);
     }
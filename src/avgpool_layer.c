@@ -2,7 +2,7 @@
 #include "cuda.h"
 #include <stdio.h>
 
-avgpool_layer make_avgpool_layer(int batch, int w, int h, int c)
+avgpool_layer make_avgpool_layer(int batch, int w, int h, int c, int inference)
 {
     fprintf(stderr, "avg                     %4d x%4d x%4d   ->  %4d\n",  w, h, c, c);
     avgpool_layer l = {0};
@@ -18,7 +18,7 @@ avgpool_layer make_avgpool_layer(int batch, int w, int h, int c)
     l.inputs = h*w*c;
     int output_size = l.outputs * batch;
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if(!inference) l.delta = calloc(output_size, sizeof(float));
     l.forward = forward_avgpool_layer;
     l.backward = backward_avgpool_layer;
     #ifdef GPU
@@ -3,7 +3,7 @@
 #include "blas.h"
 #include <stdio.h>
 
-layer make_batchnorm_layer(int batch, int w, int h, int c)
+layer make_batchnorm_layer(int batch, int w, int h, int c, int inference)
 {
     fprintf(stderr, "Batch Normalization Layer: %d x %d x %d image\n", w,h,c);
     layer l = {0};
@@ -13,21 +13,25 @@ layer make_batchnorm_layer(int batch, int w, int h, int c)
     l.w = l.out_w = w;
     l.c = l.out_c = c;
     l.output = calloc(h * w * c * batch, sizeof(float));
-    l.delta  = calloc(h * w * c * batch, sizeof(float));
+    if(!inference) l.delta = calloc(h * w * c * batch, sizeof(float));
     l.inputs = w*h*c;
     l.outputs = l.inputs;
 
     l.scales = calloc(c, sizeof(float));
-    l.scale_updates = calloc(c, sizeof(float));
     l.biases = calloc(c, sizeof(float));
-    l.bias_updates = calloc(c, sizeof(float));
+    if(!inference){
+        l.scale_updates = calloc(c, sizeof(float));
+        l.bias_updates = calloc(c, sizeof(float));
+    }
     int i;
     for(i = 0; i < c; ++i){
         l.scales[i] = 1;
     }
 
-    l.mean = calloc(c, sizeof(float));
-    l.variance = calloc(c, sizeof(float));
+    if(!inference){
+        l.mean = calloc(c, sizeof(float));
+        l.variance = calloc(c, sizeof(float));
+    }
 
     l.rolling_mean = calloc(c, sizeof(float));
     l.rolling_variance = calloc(c, sizeof(float));
@@ -191,7 +195,7 @@ void forward_batchnorm_layer(layer l, network net)
 {
     // l.type 等于 BATCHNORM 的时候，为 BATCHNORM 层。将 net.input 的值赋值为 l.output，也就是说该层的输入就是batchnorm的输入，使用l.output 是为了与下面非 BATCHNORM 层的时候统一变量名
     if(l.type == BATCHNORM) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);  
-    copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);  // batchnorm的输入为当前层输入与神经元作用后得到的l.output，所以这里将 l.output 的值赋值给 l.x
+    if(l.x) copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);  // 推理模式下没有分配 l.x。batchnorm的输入为当前层输入与神经元作用后得到的l.output，所以这里将 l.output 的值赋值给 l.x
     if(net.train){
         mean_cpu(l.output, l.batch, l.out_c, l.out_h*l.out_w, l.mean);
         variance_cpu(l.output, l.mean, l.batch, l.out_c, l.out_h*l.out_w, l.variance);
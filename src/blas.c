@@ -1,4 +1,5 @@
 #include "blas.h"
+#include "simd.h"
 
 #include <math.h>
 #include <assert.h>
@@ -108,6 +109,11 @@ void mean_cpu(float *x, int batch, int filters, int spatial, float *mean)
     int i,j,k;
     for(i = 0; i < filters; ++i){  // 对于每一个卷积核
         mean[i] = 0;
+        if(simd.sum){
+            for(j = 0; j < batch; ++j) mean[i] += simd.sum(x + j*filters*spatial + i*spatial, spatial);
+            mean[i] *= scale;
+            continue;
+        }
         for(j = 0; j < batch; ++j){  // 对于每一个batch
             for(k = 0; k < spatial; ++k){  // 对输出中的每一个元素
                 // j*filters*spatial 为具体某一个batch下的首元素偏移量，i*spatial 计算某一个卷积核下首元素的偏移量
@@ -125,6 +131,11 @@ void variance_cpu(float *x, float *mean, int batch, int filters, int spatial, fl
     int i,j,k;
     for(i = 0; i < filters; ++i){
         variance[i] = 0;
+        if(simd.sum_sq_diff){
+            for(j = 0; j < batch; ++j) variance[i] += simd.sum_sq_diff(x + j*filters*spatial + i*spatial, mean[i], spatial);
+            variance[i] *= scale;
+            continue;
+        }
         for(j = 0; j < batch; ++j){
             for(k = 0; k < spatial; ++k){
                 int index = j*filters*spatial + i*spatial + k;
@@ -171,6 +182,10 @@ void normalize_cpu(float *x, float *mean, float *variance, int batch, int filter
     int b, f, i;
     for(b = 0; b < batch; ++b){
         for(f = 0; f < filters; ++f){
+            if(simd.normalize){
+                simd.normalize(x + b*filters*spatial + f*spatial, mean[f], sqrt(variance[f]) + .000001f, spatial);
+                continue;
+            }
             for(i = 0; i < spatial; ++i){
                 int index = b*filters*spatial + f*spatial + i;
                 x[index] = (x[index] - mean[f])/(sqrt(variance[f]) + .000001f);  // 这里的.000001f是为了防止分母为零
@@ -211,6 +226,10 @@ void pow_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
 void axpy_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
 {
     int i;
+    if(simd.axpy && INCX == 1 && INCY == 1){
+        simd.axpy(N, ALPHA, X, Y);
+        return;
+    }
     for(i = 0; i < N; ++i) Y[i*INCY] += ALPHA*X[i*INCX];
 }
 
@@ -226,6 +245,10 @@ void axpy_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY)
 void scal_cpu(int N, float ALPHA, float *X, int INCX)
 {
     int i;
+    if(simd.scal && INCX == 1){
+        simd.scal(N, ALPHA, X);
+        return;
+    }
     for(i = 0; i < N; ++i) X[i*INCX] *= ALPHA;
 }
 
@@ -1,91 +1,318 @@
 #include "box.h"
+#include "simd.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+NMS 引擎：
+    所有类别中概率不为0的 (类别, 检测框) 只排序一次(按类别、再按概率从大到小)，得到每个类别的候选列表，
+    每个列表按检测框中心放进 G x G 的网格，一个框只需要和附近格子里排在它后面的框计算 IoU。
+    IoU > thresh 时两个框在 x 方向上必然满足 w_j < w_i/thresh，所以中心的距离小于 w_i(1 + 1/thresh)/2，y 方向同理，
+    据此确定要查找的格子。同一个格子里的框按名次连续存放(left,right,top,bottom,面积分开存放)，IoU 用 simd.box_iou 成批计算。
+    被抑制的结果与逐个比较的 do_nms_sort、do_nms_obj 相同；概率完全相等的框按序号先后处理
+*/
+
+#define NMS_CELL_SIZE 8   // 每个格子平均的框数
+#define NMS_MAX_GRID 64
+#define NMS_CHUNK 64
+
+typedef struct{
+    int index;    // 检测框的序号
+    int cls;      // 类别
+    float score;
+} nms_candidate;
+
+typedef struct{
+    int g;              // 网格每边的格子数
+    float x0, y0;       // 网格左上角
+    float sx, sy;       // 坐标到格子序号的比例
+    int *start;         // g*g+1 个，第 c 个格子的框为 [start[c], start[c+1])
+    int *cell;          // 每个候选所在的格子
+    int *rank;          // 按格子存放的框在列表中的名次
+    float *left, *right, *top, *bot, *area;
+} nms_grid;
+
+static int nms_candidate_comparator(const void *pa, const void *pb)
+{
+    const nms_candidate *a = pa;
+    const nms_candidate *b = pb;
+    if(a->cls != b->cls) return a->cls - b->cls;
+    if(a->score != b->score) return (a->score < b->score) ? 1 : -1;
+    return a->index - b->index;
+}
 
-int nms_comparator(const void *pa, const void *pb)
+static void box_iou_scalar(const float *a, int n, const float *left, const float *right, const float *top, const float *bot, const float *area, float *iou)
 {
-    detection a = *(detection *)pa;
-    detection b = *(detection *)pb;
-    float diff = 0;
-    if(b.sort_class >= 0){
-        diff = a.prob[b.sort_class] - b.prob[b.sort_class];
-    } else {
-        diff = a.objectness - b.objectness;
+    int i;
+    for(i = 0; i < n; ++i){
+        // 与 overlap、box_intersection、box_union 的计算顺序相同
+        float l = a[0] > left[i] ? a[0] : left[i];
+        float r = a[1] < right[i] ? a[1] : right[i];
+        float t = a[2] > top[i] ? a[2] : top[i];
+        float b = a[3] < bot[i] ? a[3] : bot[i];
+        float w = r - l;
+        float h = b - t;
+        float inter = (w < 0 || h < 0) ? 0 : w*h;
+        iou[i] = inter/(a[4] + area[i] - inter);
     }
-    if(diff < 0) return 1;
-    else if(diff > 0) return -1;
-    return 0;
 }
 
-void do_nms_obj(detection *dets, int total, int classes, float thresh)
+static void nms_grid_alloc(nms_grid *g, int m)
 {
-    int i, j, k;
-    k = total-1;
-    for(i = 0; i <= k; ++i){
-        if(dets[i].objectness == 0){
-            detection swap = dets[i];
-            dets[i] = dets[k];
-            dets[k] = swap;
-            --k;
-            --i;
-        }
-    }
-    total = k+1;
+    g->start = calloc(NMS_MAX_GRID*NMS_MAX_GRID + 1, sizeof(int));
+    g->cell = calloc(m, sizeof(int));
+    g->rank = calloc(m, sizeof(int));
+    g->left = calloc(m, sizeof(float));
+    g->right = calloc(m, sizeof(float));
+    g->top = calloc(m, sizeof(float));
+    g->bot = calloc(m, sizeof(float));
+    g->area = calloc(m, sizeof(float));
+}
 
-    for(i = 0; i < total; ++i){
-        dets[i].sort_class = -1;
+static void nms_grid_free(nms_grid *g)
+{
+    free(g->start);
+    free(g->cell);
+    free(g->rank);
+    free(g->left);
+    free(g->right);
+    free(g->top);
+    free(g->bot);
+    free(g->area);
+}
+
+static int nms_grid_coord(float v, float v0, float scale, int g)
+{
+    float c = (v - v0)*scale;
+    if(!(c > 0)) return 0;   // 同时处理 NaN
+    if(c >= g) return g - 1;
+    return (int)c;
+}
+
+// 把按名次排好的 m 个候选放进网格
+static void nms_grid_build(nms_grid *g, box *boxes, nms_candidate *cand, int m)
+{
+    int i, c;
+    float x0 = boxes[cand[0].index].x, x1 = x0;
+    float y0 = boxes[cand[0].index].y, y1 = y0;
+    for(i = 1; i < m; ++i){
+        box b = boxes[cand[i].index];
+        if(b.x < x0) x0 = b.x;
+        if(b.x > x1) x1 = b.x;
+        if(b.y < y0) y0 = b.y;
+        if(b.y > y1) y1 = b.y;
+    }
+    int n = (int)sqrt((double)m/NMS_CELL_SIZE);
+    if(n < 1) n = 1;
+    if(n > NMS_MAX_GRID) n = NMS_MAX_GRID;
+    g->g = n;
+    g->x0 = x0;
+    g->y0 = y0;
+    g->sx = (x1 > x0) ? n/(x1 - x0) : 0;
+    g->sy = (y1 > y0) ? n/(y1 - y0) : 0;
+
+    memset(g->start, 0, (n*n + 1)*sizeof(int));
+    for(i = 0; i < m; ++i){
+        box b = boxes[cand[i].index];
+        c = nms_grid_coord(b.y, y0, g->sy, n)*n + nms_grid_coord(b.x, x0, g->sx, n);
+        g->cell[i] = c;
+        ++g->start[c + 1];
+    }
+    for(c = 0; c < n*n; ++c) g->start[c + 1] += g->start[c];
+    // 按名次依次放入，每个格子里的框名次递增
+    for(i = 0; i < m; ++i){
+        box b = boxes[cand[i].index];
+        int k = g->start[g->cell[i]]++;
+        g->rank[k] = i;
+        g->left[k] = b.x - b.w/2;
+        g->right[k] = b.x + b.w/2;
+        g->top[k] = b.y - b.h/2;
+        g->bot[k] = b.y + b.h/2;
+        g->area[k] = b.w*b.h;
     }
+    for(c = n*n; c > 0; --c) g->start[c] = g->start[c-1];
+    g->start[0] = 0;
+}
 
-    qsort(dets, total, sizeof(detection), nms_comparator);
-    for(i = 0; i < total; ++i){
-        if(dets[i].objectness == 0) continue;
-        box a = dets[i].bbox;
-        for(j = i+1; j < total; ++j){
-            if(dets[j].objectness == 0) continue;
-            box b = dets[j].bbox;
-            if (box_iou(a, b) > thresh){
-                dets[j].objectness = 0;
-                for(k = 0; k < classes; ++k){
-                    dets[j].prob[k] = 0;
+/*
+输入：检测框 boxes，同一类别按名次排好的 m 个候选 cand，阈值 thresh，网格 g
+功能：贪心的 NMS：按名次依次取出没有被抑制的框，抑制排在它后面、IoU 大于 thresh 的框
+输出：suppressed[i] 为1表示第 i 名的候选被抑制
+*/
+static void nms_list(box *boxes, nms_candidate *cand, int m, float thresh, nms_grid *g, unsigned char *suppressed)
+{
+    int i, k, cx, cy;
+    float iou[NMS_CHUNK];
+    memset(suppressed, 0, m);
+    if(m < 2) return;
+    nms_grid_build(g, boxes, cand, m);
+    int n = g->g;
+    for(i = 0; i < m; ++i){
+        if(suppressed[i]) continue;
+        box b = boxes[cand[i].index];
+        float a[5] = {b.x - b.w/2, b.x + b.w/2, b.y - b.h/2, b.y + b.h/2, b.w*b.h};
+        int cx0 = 0, cx1 = n - 1, cy0 = 0, cy1 = n - 1;
+        if(thresh > 0){
+            // 查找范围稍微放大，避免舍入误差漏掉边界上的框
+            float rx = b.w*(1 + 1/thresh)/2*1.01 + 1e-6;
+            float ry = b.h*(1 + 1/thresh)/2*1.01 + 1e-6;
+            cx0 = nms_grid_coord(b.x - rx, g->x0, g->sx, n);
+            cx1 = nms_grid_coord(b.x + rx, g->x0, g->sx, n);
+            cy0 = nms_grid_coord(b.y - ry, g->y0, g->sy, n);
+            cy1 = nms_grid_coord(b.y + ry, g->y0, g->sy, n);
+        }
+        for(cy = cy0; cy <= cy1; ++cy){
+            for(cx = cx0; cx <= cx1; ++cx){
+                int c = cy*n + cx;
+                int lo = g->start[c], hi = g->start[c+1];
+                // 格子里的名次递增，二分找到第一个排在 i 后面的框
+                while(lo < hi){
+                    int mid = (lo + hi)/2;
+                    if(g->rank[mid] <= i) lo = mid + 1;
+                    else hi = mid;
+                }
+                for(; lo < g->start[c+1]; lo += NMS_CHUNK){
+                    int len = g->start[c+1] - lo;
+                    if(len > NMS_CHUNK) len = NMS_CHUNK;
+                    if(simd.box_iou) simd.box_iou(a, len, g->left + lo, g->right + lo, g->top + lo, g->bot + lo, g->area + lo, iou);
+                    else box_iou_scalar(a, len, g->left + lo, g->right + lo, g->top + lo, g->bot + lo, g->area + lo, iou);
+                    for(k = 0; k < len; ++k){
+                        if(iou[k] > thresh) suppressed[g->rank[lo + k]] = 1;
+                    }
                 }
             }
         }
     }
 }
 
-
-void do_nms_sort(detection *dets, int total, int classes, float thresh)
+/*
+输入：n 个检测框 boxes，每个框的类别概率 probs[i]（classes 个），objectness（为0时按类别做NMS），阈值 thresh
+功能：按类别做NMS时把被抑制的框在该类别上的概率置0；按 objectness 做NMS时把被抑制的框的 objectness 和所有概率置0
+*/
+static void nms_run(int n, box *boxes, float **probs, float *objectness, int classes, float thresh)
 {
     int i, j, k;
-    k = total-1;
-    for(i = 0; i <= k; ++i){
-        if(dets[i].objectness == 0){
-            detection swap = dets[i];
-            dets[i] = dets[k];
-            dets[k] = swap;
-            --k;
-            --i;
+    int count = 0;
+    nms_candidate *cand = 0;
+    if(objectness){
+        cand = calloc(n, sizeof(nms_candidate));
+        for(i = 0; i < n; ++i){
+            if(objectness[i] == 0) continue;
+            cand[count].index = i;
+            cand[count].cls = 0;
+            cand[count].score = objectness[i];
+            ++count;
         }
-    }
-    total = k+1;
-
-    for(k = 0; k < classes; ++k){
-        for(i = 0; i < total; ++i){
-            dets[i].sort_class = k;
+    } else {
+        for(i = 0; i < n; ++i){
+            for(k = 0; k < classes; ++k) if(probs[i][k] != 0) ++count;
         }
-        qsort(dets, total, sizeof(detection), nms_comparator);
-        for(i = 0; i < total; ++i){
-            if(dets[i].prob[k] == 0) continue;
-            box a = dets[i].bbox;
-            for(j = i+1; j < total; ++j){
-                box b = dets[j].bbox;
-                if (box_iou(a, b) > thresh){
-                    dets[j].prob[k] = 0;
-                }
+        cand = calloc(count, sizeof(nms_candidate));
+        count = 0;
+        for(i = 0; i < n; ++i){
+            for(k = 0; k < classes; ++k){
+                if(probs[i][k] == 0) continue;
+                cand[count].index = i;
+                cand[count].cls = k;
+                cand[count].score = probs[i][k];
+                ++count;
             }
         }
     }
+    qsort(cand, count, sizeof(nms_candidate), nms_candidate_comparator);
+
+    nms_grid g = {0};
+    nms_grid_alloc(&g, count);
+    unsigned char *suppressed = calloc(count, 1);
+    for(i = 0; i < count; i = j){
+        for(j = i; j < count && cand[j].cls == cand[i].cls; ++j);
+        nms_list(boxes, cand + i, j - i, thresh, &g, suppressed);
+        for(k = 0; k < j - i; ++k){
+            if(!suppressed[k]) continue;
+            nms_candidate c = cand[i + k];
+            if(objectness){
+                objectness[c.index] = 0;
+                memset(probs[c.index], 0, classes*sizeof(float));
+            } else {
+                probs[c.index][c.cls] = 0;
+            }
+        }
+    }
+    free(suppressed);
+    nms_grid_free(&g);
+    free(cand);
+}
+
+/*
+输入：检测结果 dets，检测框个数 total，类别数 classes，阈值 thresh
+功能：按 objectness 做NMS，被抑制的框 objectness 和所有类别的概率置0。dets 的顺序不变
+*/
+void do_nms_obj(detection *dets, int total, int classes, float thresh)
+{
+    int i;
+    box *boxes = calloc(total, sizeof(box));
+    float **probs = calloc(total, sizeof(float *));
+    float *objectness = calloc(total, sizeof(float));
+    for(i = 0; i < total; ++i){
+        boxes[i] = dets[i].bbox;
+        probs[i] = dets[i].prob;
+        objectness[i] = dets[i].objectness;
+    }
+    nms_run(total, boxes, probs, objectness, classes, thresh);
+    for(i = 0; i < total; ++i) dets[i].objectness = objectness[i];
+    free(objectness);
+    free(probs);
+    free(boxes);
+}
+
+/*
+输入：同 do_nms_obj
+功能：每个类别分别做NMS，被抑制的框在该类别上的概率置0。dets 的顺序不变
+*/
+void do_nms_sort(detection *dets, int total, int classes, float thresh)
+{
+    int i;
+    box *boxes = calloc(total, sizeof(box));
+    float **probs = calloc(total, sizeof(float *));
+    for(i = 0; i < total; ++i){
+        boxes[i] = dets[i].bbox;
+        probs[i] = dets[i].prob;
+    }
+    nms_run(total, boxes, probs, 0, classes, thresh);
+    free(probs);
+    free(boxes);
+}
+
+static float **detection_batch_probs(detection_batch *b)
+{
+    int i;
+    float **probs = calloc(b->n, sizeof(float *));
+    for(i = 0; i < b->n; ++i) probs[i] = b->prob + (size_t)i*b->classes;
+    return probs;
+}
+
+/*
+输入：检测结果 b，阈值 thresh
+功能：与 do_nms_obj 相同，直接在 b 的数组上计算
+*/
+void do_nms_obj_batch(detection_batch *b, float thresh)
+{
+    float **probs = detection_batch_probs(b);
+    nms_run(b->n, b->boxes, probs, b->objectness, b->classes, thresh);
+    free(probs);
+}
+
+/*
+输入：检测结果 b，阈值 thresh
+功能：与 do_nms_sort 相同，直接在 b 的数组上计算
+*/
+void do_nms_sort_batch(detection_batch *b, float thresh)
+{
+    float **probs = detection_batch_probs(b);
+    nms_run(b->n, b->boxes, probs, 0, b->classes, thresh);
+    free(probs);
 }
 
 box float_to_box(float *f, int stride)
@@ -11,7 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam)
+layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam, int inference)
 {
     int i;
     layer l = {0};
@@ -30,10 +30,11 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     l.out_c = outputs;
 
     l.output = calloc(batch*outputs, sizeof(float));
-    l.delta = calloc(batch*outputs, sizeof(float));
-
-    l.weight_updates = calloc(inputs*outputs, sizeof(float));
-    l.bias_updates = calloc(outputs, sizeof(float));
+    if(!inference){
+        l.delta = calloc(batch*outputs, sizeof(float));
+        l.weight_updates = calloc(inputs*outputs, sizeof(float));
+        l.bias_updates = calloc(outputs, sizeof(float));
+    }
 
     l.weights = calloc(outputs*inputs, sizeof(float));
     l.biases = calloc(outputs, sizeof(float));
@@ -52,7 +53,7 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
         l.biases[i] = 0;
     }
 
-    if(adam){
+    if(adam && !inference){
         l.m = calloc(l.inputs*l.outputs, sizeof(float));
         l.v = calloc(l.inputs*l.outputs, sizeof(float));
         l.bias_m = calloc(l.outputs, sizeof(float));
@@ -62,21 +63,22 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     }
     if(batch_normalize){
         l.scales = calloc(outputs, sizeof(float));
-        l.scale_updates = calloc(outputs, sizeof(float));
         for(i = 0; i < outputs; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(outputs, sizeof(float));
-        l.mean_delta = calloc(outputs, sizeof(float));
-        l.variance = calloc(outputs, sizeof(float));
-        l.variance_delta = calloc(outputs, sizeof(float));
-
         l.rolling_mean = calloc(outputs, sizeof(float));
         l.rolling_variance = calloc(outputs, sizeof(float));
 
-        l.x = calloc(batch*outputs, sizeof(float));
-        l.x_norm = calloc(batch*outputs, sizeof(float));
+        if(!inference){
+            l.scale_updates = calloc(outputs, sizeof(float));
+            l.mean = calloc(outputs, sizeof(float));
+            l.mean_delta = calloc(outputs, sizeof(float));
+            l.variance = calloc(outputs, sizeof(float));
+            l.variance_delta = calloc(outputs, sizeof(float));
+            l.x = calloc(batch*outputs, sizeof(float));
+            l.x_norm = calloc(batch*outputs, sizeof(float));
+        }
     }
 
 #ifdef GPU
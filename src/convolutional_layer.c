@@ -5,6 +5,7 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -125,7 +126,18 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
-    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+    size_t size = (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+#ifdef GPU
+    if(gpu_index >= 0) return size;
+#endif
+    if(l.implicit) size = 0;  // 隐式gemm不需要存放im2col的结果
+    if(l.winograd){
+        size_t s = get_winograd_workspace_size(l);
+        if(s > size) size = s;
+    }
+    // 末尾留给推理时由 batchnorm 换算出的每个通道的系数和偏置，见 forward_convolutional_layer
+    if(l.batch_normalize) size += 2*l.n*sizeof(float);
+    return size;
 }
 
 #ifdef GPU
@@ -187,10 +199,11 @@ void cudnn_convolutional_setup(layer *l)
 输入：
     n  filters的数量
     c  输入数据的通道数
+    inference  为1时只分配前向计算需要的内存(推理网络)
 功能：对卷阶层各个参数进行分配内存或者初始化，并计算输入输出大小
 返回：分配内存或者初始化后的卷阶层layer
 */
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam)
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int inference)
 {
     int i;
     // 初始化结构体变量，这里的是局部变量；calloc sizeof(convolutional_layer)分配在堆上
@@ -219,10 +232,12 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     groups将输入的channel分割成groups份，对应的卷积核channel也分割成groups份，c/groups*n*size*size得到总的权重数量
     */
     l.weights = calloc(c/groups*n*size*size, sizeof(float));  // 为权重分配内存
-    l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
-
     l.biases = calloc(n, sizeof(float));  // 为偏置分配内存
-    l.bias_updates = calloc(n, sizeof(float));
+    // 推理模式下不分配反向传播和更新权重用到的内存
+    if(!inference){
+        l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
+        l.bias_updates = calloc(n, sizeof(float));
+    }
 
     l.nweights = c/groups*n*size*size;  // 总权重数量
     l.nbiases = n; // 总偏置数量
@@ -242,7 +257,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.inputs = l.w * l.h * l.c;  // 每次batch输入的大小
 
     l.output = calloc(l.batch*l.outputs, sizeof(float)); // 存放每组batch总输出
-    l.delta  = calloc(l.batch*l.outputs, sizeof(float));  // 存放损失函数关于每batch个样本的 z 的梯度
+    if(!inference) l.delta = calloc(l.batch*l.outputs, sizeof(float));  // 存放损失函数关于每batch个样本的 z 的梯度
 
     l.forward = forward_convolutional_layer;   // 结构体中函数的应用
     l.backward = backward_convolutional_layer;
@@ -259,23 +274,25 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 
     if(batch_normalize){
         l.scales = calloc(n, sizeof(float));  // batchnorm 层中gamma参数初始化
-        l.scale_updates = calloc(n, sizeof(float));
         for(i = 0; i < n; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(n, sizeof(float));
-        l.variance = calloc(n, sizeof(float));
-
-        l.mean_delta = calloc(n, sizeof(float));
-        l.variance_delta = calloc(n, sizeof(float));
-
         l.rolling_mean = calloc(n, sizeof(float));
         l.rolling_variance = calloc(n, sizeof(float));
-        l.x = calloc(l.batch*l.outputs, sizeof(float));
-        l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+
+        // 推理时 batchnorm 只用到 scales 和滚动均值方差，forward_convolutional_layer 会把它们放到gemm的尾处理中
+        if(!inference){
+            l.scale_updates = calloc(n, sizeof(float));
+            l.mean = calloc(n, sizeof(float));
+            l.variance = calloc(n, sizeof(float));
+            l.mean_delta = calloc(n, sizeof(float));
+            l.variance_delta = calloc(n, sizeof(float));
+            l.x = calloc(l.batch*l.outputs, sizeof(float));
+            l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        }
     }
-    if(adam){
+    if(adam && !inference){
         l.m = calloc(l.nweights, sizeof(float));
         l.v = calloc(l.nweights, sizeof(float));
         l.bias_m = calloc(n, sizeof(float));
@@ -353,6 +370,31 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     return l;
 }
 
+/*
+输入：卷积层 l，是否使用隐式gemm implicit
+功能：设置卷积层在CPU上的前向计算是否使用隐式gemm，并重新计算该层所需的工作空间大小。
+     隐式gemm在打包时直接从输入中按块取数，不再需要 net.workspace 存放整张im2col矩阵；
+     反向传播仍然需要im2col矩阵，此时在 backward_convolutional_layer 中临时分配。
+输出：无
+*/
+void set_convolutional_implicit(convolutional_layer *l, int implicit)
+{
+    l->implicit = implicit;
+    l->workspace_size = get_workspace_size(*l);
+}
+
+/*
+输入：卷积层 l，Winograd输出块大小 m（2或4，为0表示关闭）
+功能：设置卷积层在CPU上的前向计算是否使用Winograd F(mxm,3x3)，该层不满足条件时自动关闭，
+     并重新计算该层所需的工作空间大小
+输出：无
+*/
+void set_convolutional_winograd(convolutional_layer *l, int m)
+{
+    make_winograd_weights(l, m);
+    l->workspace_size = get_workspace_size(*l);
+}
+
 void denormalize_convolutional_layer(convolutional_layer l)
 {
     int i, j;
@@ -366,6 +408,45 @@ void denormalize_convolutional_layer(convolutional_layer l)
         l.rolling_mean[i] = 0;
         l.rolling_variance[i] = 1;
     }
+    transform_winograd_weights(l);
+}
+
+/*
+输入：卷积层 l
+功能：推理时把 batchnorm 折叠进卷积计算：w' = w*gamma/(sqrt(var)+eps)，b' = beta - mean*gamma/(sqrt(var)+eps)，
+     与 forward_batchnorm_layer 非训练状态下的计算一致，并释放仅在训练时使用的 x、x_norm、mean、variance 等缓存。
+     CPU上不修改 l->weights、l->biases(它们可能直接指向 load_weights_mapped 映射的文件)：
+     释放 l->x 之后 forward_convolutional_layer 把每个通道的系数和偏置放到gemm的尾处理中，结果相同。
+     GPU上把系数直接乘进卷积核和偏置。折叠后的层不能再用于训练
+输出：GPU上为 l->weights, l->biases
+*/
+void fuse_batchnorm_convolutional_layer(convolutional_layer *l)
+{
+    if(!l->batch_normalize) return;
+#ifdef GPU
+    if(gpu_index >= 0){
+        int i, j;
+        int size = l->c/l->groups*l->size*l->size;
+        for(i = 0; i < l->n; ++i){
+            float scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+            for(j = 0; j < size; ++j){
+                l->weights[i*size + j] *= scale;
+            }
+            l->biases[i] = l->biases[i] - l->rolling_mean[i]*scale;
+        }
+        l->batch_normalize = 0;
+        push_convolutional_layer(*l);
+    }
+#endif
+    free(l->x);
+    free(l->x_norm);
+    free(l->mean);
+    free(l->variance);
+    free(l->mean_delta);
+    free(l->variance_delta);
+    l->x = l->x_norm = 0;
+    l->mean = l->variance = 0;
+    l->mean_delta = l->variance_delta = 0;
 }
 
 /*
@@ -407,8 +488,8 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->inputs = l->w * l->h * l->c;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->x){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
     }
@@ -509,8 +590,27 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
+    // 下面的gemm都以 BETA=0 直接写回 l.output，不需要先用 fill_cpu 清零
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);  // 将l.output以0全部填充，防止上次输入batch个数据前向计算的结果对本次造成影响
+    /*
+    偏置和激活函数放在gemm写回输出时的尾处理中完成，不再单独调用 add_bias、activate_array。
+    带 batchnorm 的层在训练时需要 l.x、l.x_norm 以及当前batch的均值方差，仍然走 forward_batchnorm_layer；
+    推理时如果没有分配 l.x，说明不需要反向传播，把滚动均值方差换算成每个通道的系数和偏置，也放到尾处理中。
+    系数和偏置放在工作空间的末尾(get_workspace_size 中预留)，gemm、im2col、Winograd 都不会用到这一段
+    */
+    gemm_epilogue ep = {0, l.biases, l.activation};
+    int fused = !l.batch_normalize;
+    if(l.batch_normalize && !net.train && !l.x){
+        float *bn_scales = (float *)((char *)net.workspace + l.workspace_size) - 2*l.n;
+        float *bn_biases = bn_scales + l.n;
+        for(i = 0; i < l.n; ++i){
+            bn_scales[i] = l.scales[i]/(sqrt(l.rolling_variance[i]) + .000001f);
+            bn_biases[i] = l.biases[i] - l.rolling_mean[i]*bn_scales[i];
+        }
+        ep.scales = bn_scales;
+        ep.biases = bn_biases;
+        fused = 1;
+    }
 
     if(l.xnor){
         binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
@@ -535,11 +635,24 @@ void forward_convolutional_layer(convolutional_layer l, network net)
             float *c = l.output + (i*l.groups + j)*n*m;
             // net.input 表示当前层的输入(batchsize 个样本)，l.c/l.groups*l.h*l.w表示每次每组输入的大小,所以 *im为当前样本当前组的输入数据位置
             float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+            // 当前组的输出通道对应的尾处理
+            gemm_epilogue gep = ep;
+            if(gep.scales) gep.scales += j*m;
+            gep.biases += j*m;
+            gemm_epilogue *e = fused ? &gep : 0;
             
             // 对图片进行重新排列，指针b 指向重新排列后的数据
-            if (l.size == 1) {
+            if (l.winograd) {
+                // Winograd 不需要im2col，结果直接写入 c
+                forward_winograd_cpu(l, im, net.workspace, c, e);
+                continue;
+            } else if (l.size == 1) {
                 // TODO: im的大小为l.c/l.groups*l.h*l.w，而下面gemm中b的大小为l.size*l.size*l.c/l.groups X l.out_w*l.out_h，当步长不为1或者有补零的时候，l.h*l.w不等于l.out_w*l.out_h
                 b = im;
+            } else if (l.implicit) {
+                // 隐式gemm，直接从 im 中按块取数，不生成im2col矩阵
+                gemm_conv_cpu(m, n, k, 1, a, k, im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, 0, c, n, e);
+                continue;
             } else {
                 im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b); // l.h, l.w 为输入大小
             }
@@ -557,19 +670,16 @@ void forward_convolutional_layer(convolutional_layer l, network net)
             ldc 每次卷积输出的高和宽的乘积，用于定位卷积输出数组元素的位置
 
             广义矩阵乘积操作(gemm) C = ALPHA*A*B + BETA*C
-            这里ALPHA和BETA均取值为1，完成 l.c/l.groups 组卷积操作，怀疑此处的 BETA并没有什么作用，因此每次 c 均是全零的
+            这里ALPHA取值为1，BETA取值为0，即直接写回 c，完成 l.c/l.groups 组卷积操作；e 不为0时写回的同时加上偏置并做激活
             */
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
+            gemm_fused_cpu(0,0,m,n,k,1,a,k,b,n,0,c,n,e);
         }
     }
 
-    if(l.batch_normalize){
+    if(!fused){
         forward_batchnorm_layer(l, net);   // 对该层的输出进行batch_normalize，该函数中已经调用了add_bias函数。在激励函数前进行
-    } else {
-        add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w); // 对每一个输出点加上偏置
+        activate_array(l.output, l.outputs*l.batch, l.activation);  // 对l.output 中每一个点均经过激活函数
     }
-
-    activate_array(l.output, l.outputs*l.batch, l.activation);  // 对l.output 中每一个点均经过激活函数
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
@@ -586,6 +696,9 @@ void backward_convolutional_layer(convolutional_layer l, network net)
     int m = l.n/l.groups; // l.n是filters数量，除以l.groups得到每组filters的数量
     int n = l.size*l.size*l.c/l.groups;  // 将卷积核分组后，每个卷积核的参数总数
     int k = l.out_w*l.out_h;  // 每次卷积输出的高和宽的乘积
+    float *workspace = net.workspace;
+    // 隐式gemm的层没有在 net.workspace 中预留im2col的空间，反向传播时临时分配
+    if(l.implicit && l.size != 1) workspace = calloc((size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups, sizeof(float));
 
     // 对数组l.output中所有元素关于net(o = f(net), f为激活函数)的梯度，并与之前得到的(上一层的backward函数) l.delta 做点乘，得到完整的 l.delta
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
@@ -601,7 +714,7 @@ void backward_convolutional_layer(convolutional_layer l, network net)
         for(j = 0; j < l.groups; ++j){ // 每组
             // m*k为每个样本每组输出大小，所以 *a 为当前样本当前组的 delta值
             float *a = l.delta + (i*l.groups + j)*m*k;   
-            float *b = net.workspace;   // net.workspace 可以看做为缓冲空间
+            float *b = workspace;   // net.workspace 可以看做为缓冲空间
             // l.nweights/l.groups为每组的权重大小，又因为一个batch之内的相同组的权重相同，与i无关，所以 *c表示存储当前组权重更新的位置
             float *c = l.weight_updates + j*l.nweights/l.groups;
             
@@ -626,7 +739,7 @@ void backward_convolutional_layer(convolutional_layer l, network net)
                 a = l.weights + j*l.nweights/l.groups;
                 // *b 为当前样本当前组的 delta值
                 b = l.delta + (i*l.groups + j)*m*k;
-                c = net.workspace;  // 下面beta的值等于0，会刷新掉当前net.workspace的值
+                c = workspace;  // 下面beta的值等于0，会刷新掉当前net.workspace的值
                 if (l.size == 1) {
                     c = imd;
                 }
@@ -636,11 +749,12 @@ void backward_convolutional_layer(convolutional_layer l, network net)
                 gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
 
                 if (l.size != 1) {
-                    col2im_cpu(net.workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, imd);
+                    col2im_cpu(workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, imd);
                 }
             }
         }
     }
+    if(workspace != net.workspace) free(workspace);
 }
 
 void update_convolutional_layer(convolutional_layer l, update_args a)
@@ -661,6 +775,7 @@ void update_convolutional_layer(convolutional_layer l, update_args a)
     axpy_cpu(l.nweights, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.nweights, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+    transform_winograd_weights(l);
 }
 
 
@@ -681,6 +796,7 @@ void rgbgr_weights(convolutional_layer l)
             rgbgr_image(im);
         }
     }
+    transform_winograd_weights(l);
 }
 
 void rescale_weights(convolutional_layer l, float scale, float trans)
@@ -694,6 +810,7 @@ void rescale_weights(convolutional_layer l, float scale, float trans)
             l.biases[i] += sum*trans;
         }
     }
+    transform_winograd_weights(l);
 }
 
 image *get_weights(convolutional_layer l)
@@ -25,8 +25,11 @@ void cudnn_convolutional_setup(layer *l);
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int inference);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+void set_convolutional_implicit(convolutional_layer *layer, int implicit);
+void set_convolutional_winograd(convolutional_layer *layer, int m);
+void fuse_batchnorm_convolutional_layer(convolutional_layer *layer);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
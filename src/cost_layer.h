@@ -7,7 +7,7 @@ typedef layer cost_layer;
 
 COST_TYPE get_cost_type(char *s);
 char *get_cost_string(COST_TYPE a);
-cost_layer make_cost_layer(int batch, int inputs, COST_TYPE type, float scale);
+cost_layer make_cost_layer(int batch, int inputs, COST_TYPE type, float scale, int inference);
 void forward_cost_layer(const cost_layer l, network net);
 void backward_cost_layer(const cost_layer l, network net);
 void resize_cost_layer(cost_layer *l, int inputs);
@@ -2,6 +2,9 @@
 #include "utils.h"
 #include "image.h"
 #include "cuda.h"
+#include "shard.h"
+#include "sampler.h"
+#include "label_set.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,10 +46,231 @@ char **get_random_paths_indexes(char **paths, int n, int m, int *indexes)
 }
 */
 
+/*
+解码后图片的 LRU 缓存：
+    以路径为键缓存 load_image_stb_u8 解码得到的 uint8 像素，多个加载线程共享。
+    总大小超过 set_image_cache_size 设置的上限时淘汰最久没有使用的图片，上限为0(默认)时不使用缓存。
+    正在被使用的图片用引用计数保护，被淘汰时等最后一个使用者释放之后再释放内存。
+*/
+#define IMAGE_CACHE_BUCKETS 65536
+
+typedef struct image_cache_entry{
+    char *path;
+    unsigned char *data;
+    int w, h, c;
+    size_t bytes;
+    int refs;
+    int evicted;
+    struct image_cache_entry *hnext;       // 同一个哈希桶中的下一项
+    struct image_cache_entry *prev, *next; // LRU 链表，head 为最近使用
+} image_cache_entry;
+
+static pthread_mutex_t image_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static image_cache_entry **image_cache_table = 0;
+static image_cache_entry *image_cache_head = 0;
+static image_cache_entry *image_cache_tail = 0;
+static size_t image_cache_limit = 0;
+static size_t image_cache_bytes = 0;
+static size_t image_cache_hits = 0;
+static size_t image_cache_misses = 0;
+
+static unsigned int image_cache_hash(char *s)
+{
+    unsigned int h = 5381;
+    while(*s) h = h*33 + (unsigned char)*s++;
+    return h % IMAGE_CACHE_BUCKETS;
+}
+
+static void image_cache_unlink(image_cache_entry *e)
+{
+    if(e->prev) e->prev->next = e->next;
+    else image_cache_head = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else image_cache_tail = e->prev;
+    e->prev = e->next = 0;
+}
+
+static void image_cache_push_front(image_cache_entry *e)
+{
+    e->next = image_cache_head;
+    e->prev = 0;
+    if(image_cache_head) image_cache_head->prev = e;
+    image_cache_head = e;
+    if(!image_cache_tail) image_cache_tail = e;
+}
+
+static void image_cache_free_entry(image_cache_entry *e)
+{
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+// 从哈希表和 LRU 链表中移除，没有使用者时立即释放。需要持有 image_cache_mutex
+static void image_cache_evict(image_cache_entry *e)
+{
+    image_cache_entry **p = image_cache_table + image_cache_hash(e->path);
+    while(*p != e) p = &(*p)->hnext;
+    *p = e->hnext;
+    image_cache_unlink(e);
+    image_cache_bytes -= e->bytes;
+    e->evicted = 1;
+    if(!e->refs) image_cache_free_entry(e);
+}
+
+/*
+输入：缓存的大小上限 bytes(字节)，为0时关闭缓存
+功能：设置解码后图片缓存的大小上限，超出部分按 LRU 淘汰
+*/
+void set_image_cache_size(size_t bytes)
+{
+    pthread_mutex_lock(&image_cache_mutex);
+    image_cache_limit = bytes;
+    if(bytes && !image_cache_table) image_cache_table = calloc(IMAGE_CACHE_BUCKETS, sizeof(image_cache_entry *));
+    while(image_cache_tail && image_cache_bytes > image_cache_limit) image_cache_evict(image_cache_tail);
+    pthread_mutex_unlock(&image_cache_mutex);
+}
+
+/*
+功能：取出缓存的统计：命中次数、未命中次数和当前占用的字节数，不需要的参数可以为0
+*/
+void image_cache_stats(size_t *hits, size_t *misses, size_t *bytes)
+{
+    pthread_mutex_lock(&image_cache_mutex);
+    if(hits) *hits = image_cache_hits;
+    if(misses) *misses = image_cache_misses;
+    if(bytes) *bytes = image_cache_bytes;
+    pthread_mutex_unlock(&image_cache_mutex);
+}
+
+/*
+输入：图片路径 path
+功能：取出解码后的 uint8 图像(3通道)，开启缓存时先在缓存中查找，没有时解码并放入缓存。
+     来自缓存的图像与缓存共享像素，*ref 指向对应的缓存项，用完之后需要调用 release_image_cached 释放
+返回：uint8 图像
+*/
+static image_u8 load_image_cached_u8(char *path, image_cache_entry **ref)
+{
+    *ref = 0;
+    if(!image_cache_limit) return load_image_u8(path, 0, 0, 3);
+
+    unsigned int bucket = image_cache_hash(path);
+    pthread_mutex_lock(&image_cache_mutex);
+    image_cache_entry *e = image_cache_table[bucket];
+    while(e && strcmp(e->path, path)) e = e->hnext;
+    if(e){
+        ++image_cache_hits;
+        ++e->refs;
+        image_cache_unlink(e);
+        image_cache_push_front(e);
+    } else {
+        ++image_cache_misses;
+    }
+    pthread_mutex_unlock(&image_cache_mutex);
+
+    image_u8 im;
+    if(e){
+        *ref = e;
+        im.w = e->w;
+        im.h = e->h;
+        im.c = e->c;
+        im.data = e->data;
+        return im;
+    }
+
+    im = load_image_u8(path, 0, 0, 3);
+    size_t n = (size_t)im.w*im.h*im.c;
+    pthread_mutex_lock(&image_cache_mutex);
+    image_cache_entry *found = image_cache_table[bucket];
+    while(found && strcmp(found->path, path)) found = found->hnext;
+    if(!found && n <= image_cache_limit){
+        e = calloc(1, sizeof(image_cache_entry));
+        e->path = copy_string(path);
+        e->data = im.data;
+        e->w = im.w;
+        e->h = im.h;
+        e->c = im.c;
+        e->bytes = n;
+        e->refs = 1;
+        e->hnext = image_cache_table[bucket];
+        image_cache_table[bucket] = e;
+        image_cache_push_front(e);
+        image_cache_bytes += n;
+        while(image_cache_bytes > image_cache_limit) image_cache_evict(image_cache_tail);
+        *ref = e;
+    }
+    pthread_mutex_unlock(&image_cache_mutex);
+    return im;
+}
+
+/*
+输入：load_image_cached_u8 返回的图像 im 和缓存项 ref
+功能：释放图像，来自缓存时只减少引用计数，缓存项已经被淘汰且没有其他使用者时释放
+*/
+static void release_image_cached(image_u8 im, image_cache_entry *ref)
+{
+    if(!ref){
+        free_image_u8(im);
+        return;
+    }
+    pthread_mutex_lock(&image_cache_mutex);
+    --ref->refs;
+    if(ref->evicted && !ref->refs) image_cache_free_entry(ref);
+    pthread_mutex_unlock(&image_cache_mutex);
+}
+
+/*
+输入：图片路径 path，w,h 不为0时缩放到 w x h
+功能：与 load_image_color 相同，开启缓存时通过 load_image_cached_u8 取出 uint8 像素再转换成 float
+返回：新分配的 float 图像
+*/
+static image load_image_cached(char *path, int w, int h)
+{
+    if(!image_cache_limit) return load_image_color(path, w, h);
+
+    image_cache_entry *ref;
+    image_u8 src = load_image_cached_u8(path, &ref);
+    image im = make_image(src.w, src.h, src.c);
+    image_u8_to_float(src, im.data);
+    release_image_cached(src, ref);
+
+    if(w && h && (w != im.w || h != im.h)){
+        image resized = resize_image(im, w, h);
+        free_image(im);
+        im = resized;
+    }
+    return im;
+}
+
+/*
+输入：样本总数 m
+功能：随机选出 n 个样本的序号，与 get_random_paths 相同，用于从分片中取样本
+*/
+static int *get_random_indexes(int n, int m)
+{
+    int *indexes = calloc(n, sizeof(int));
+    int i;
+    pthread_mutex_lock(&mutex);
+    for(i = 0; i < n; ++i){
+        indexes[i] = rand()%m;
+    }
+    pthread_mutex_unlock(&mutex);
+    return indexes;
+}
+
+/*
+输入：路径 paths，需要的个数 n，路径总数 m
+功能：有放回地随机选出 n 个路径。m 为0时表示 paths 已经选好(例如由 sampler 选出)，按顺序取前 n 个
+返回：新分配的路径数组(路径本身不复制)
+*/
 char **get_random_paths(char **paths, int n, int m)
 {
     char **random_paths = calloc(n, sizeof(char*));
     int i;
+    if(!m){
+        for(i = 0; i < n; ++i) random_paths[i] = paths[i];
+        return random_paths;
+    }
     pthread_mutex_lock(&mutex);
     for(i = 0; i < n; ++i){
         int index = rand()%m;
@@ -99,7 +323,7 @@ matrix load_image_paths(char **paths, int n, int w, int h)
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], w, h);
+        image im = load_image_cached(paths[i], w, h);
         X.vals[i] = im.data;
         X.cols = im.h*im.w*im.c;
     }
@@ -115,7 +339,7 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        image im = load_image_cached(paths[i], 0, 0);
         image crop;
         if(center){
             crop = center_crop_image(im, size, size);
@@ -448,9 +672,13 @@ void fill_truth_mask(char *path, int num_boxes, float *truth, int classes, int w
 }
 
 
-void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+/*
+输入：图片路径 path
+功能：由图片路径得到对应的标签文件路径：images、JPEGImages 目录换成 labels，扩展名换成 .txt
+输出：labelpath
+*/
+void detection_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "images", "labels", labelpath);
     find_replace(labelpath, "JPEGImages", "labels", labelpath);
 
@@ -459,8 +687,14 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
+}
+
+/*
+输入：一张图片的标签框 boxes(个数为 count，会被打乱顺序和修改)，最多 num_boxes 个
+功能：根据图片的平移缩放(dx,dy,sx,sy)和翻转调整标签框，按 x,y,w,h,id 写入 truth
+*/
+static void fill_truth_boxes(box_label *boxes, int count, int num_boxes, float *truth, int flip, float dx, float dy, float sx, float sy)
+{
     randomize_boxes(boxes, count);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > num_boxes) count = num_boxes;
@@ -487,6 +721,15 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
         truth[(i-sub)*5+3] = h;
         truth[(i-sub)*5+4] = id;
     }
+}
+
+void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
+    char labelpath[4096];
+    detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *boxes = read_boxes(labelpath, &count);
+    fill_truth_boxes(boxes, count, num_boxes, truth, flip, dx, dy, sx, sy);
     free(boxes);
 }
 
@@ -760,7 +1003,7 @@ data load_data_seg(int n, char **paths, int m, int w, int h, int classes, int mi
     d.y.vals = calloc(d.X.rows, sizeof(float*));
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_image_cached(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
@@ -805,7 +1048,7 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
     d.y = make_matrix(n, (((w/div)*(h/div))+1)*boxes);
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_image_cached(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
@@ -845,7 +1088,7 @@ data load_data_mask(int n, char **paths, int m, int w, int h, int classes, int b
     d.y = make_matrix(n, (coords+1)*boxes);
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_image_cached(random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
@@ -886,7 +1129,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
     int k = size*size*(5+classes);
     d.y = make_matrix(n, k);
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_image_cached(random_paths[i], 0, 0);
 
         int oh = orig.h;
         int ow = orig.w;
@@ -939,8 +1182,8 @@ data load_data_compare(int n, char **paths, int m, int classes, int w, int h)
     int k = 2*(classes);
     d.y = make_matrix(n, k);
     for(i = 0; i < n; ++i){
-        image im1 = load_image_color(paths[i*2],   w, h);
-        image im2 = load_image_color(paths[i*2+1], w, h);
+        image im1 = load_image_cached(paths[i*2],   w, h);
+        image im2 = load_image_cached(paths[i*2+1], w, h);
 
         d.X.vals[i] = calloc(d.X.cols, sizeof(float));
         memcpy(d.X.vals[i],         im1.data, h*w*3*sizeof(float));
@@ -994,7 +1237,7 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     int index = rand()%n;
     char *random_path = paths[index];
 
-    image orig = load_image_color(random_path, 0, 0);
+    image orig = load_image_cached(random_path, 0, 0);
     int h = orig.h;
     int w = orig.w;
 
@@ -1042,68 +1285,144 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     return d;
 }
 
-data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+/*
+输入：图片路径 path 或者分片集合 shards 中的第 index 个样本(shards 不为0时)，labels 不为0时从中取 path 的标签，
+     网络输入大小 w,h，x 为 w*h*3 的输出图像，y 为 5*boxes 的标签(调用前需清零)
+功能：读取一张检测训练图片，做随机缩放平移、颜色扰动和翻转之后写入 x，对应调整后的标签写入 y
+*/
+static void load_detection_sample(char *path, shard_set *shards, int index, label_set *labels, float *x, float *y, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
 {
-    char **random_paths = get_random_paths(paths, n, m);
-    int i;
-    data d = {0};
-    d.shallow = 0;
+    // 原图保持为 uint8(分片中的图像直接指向 mmap)，只在写入 x 时转换成 float
+    image_cache_entry *ref = 0;
+    image_u8 orig = shards ? get_shard_image(shards, index) : load_image_cached_u8(path, &ref);
+    image sized = float_to_image(w, h, 3, x);
 
-    d.X.rows = n;
-    d.X.vals = calloc(d.X.rows, sizeof(float*));
-    d.X.cols = h*w*3;
+    float dw = jitter * orig.w;
+    float dh = jitter * orig.h;
 
-    d.y = make_matrix(n, 5*boxes);
-    for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
-        image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
+    float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
+    //float scale = rand_uniform(.25, 2);
+    float scale = 1;
 
-        float dw = jitter * orig.w;
-        float dh = jitter * orig.h;
+    float nw, nh;
 
-        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
-        //float scale = rand_uniform(.25, 2);
-        float scale = 1;
+    if(new_ar < 1){
+        nh = scale * h;
+        nw = nh * new_ar;
+    } else {
+        nw = scale * w;
+        nh = nw / new_ar;
+    }
 
-        float nw, nh;
+    float dx = rand_uniform(0, w - nw);
+    float dy = rand_uniform(0, h - nh);
 
-        if(new_ar < 1){
-            nh = scale * h;
-            nw = nh * new_ar;
+    // 随机数的使用顺序与 random_distort_image 以及之后的翻转相同
+    float dhue = rand_uniform(-hue, hue);
+    float dsat = rand_scale(saturation);
+    float dexp = rand_scale(exposure);
+    int flip = rand()%2;
+
+    // 填充背景、放置、颜色扰动和翻转在一次遍历中完成
+    place_distort_image(orig, nw, nh, dx, dy, dhue, dsat, dexp, flip, sized);
+
+    if(shards){
+        int count = 0;
+        box_label *shard_boxes = load_shard_boxes(shards, index, &count);
+        fill_truth_boxes(shard_boxes, count, boxes, y, flip, -dx/w, -dy/h, nw/w, nh/h);
+        free(shard_boxes);
+    } else {
+        int i = labels ? label_set_find(labels, path) : -1;
+        if(i >= 0){
+            int count = 0;
+            box_label *label_boxes = label_set_boxes(labels, i, &count);
+            fill_truth_boxes(label_boxes, count, boxes, y, flip, -dx/w, -dy/h, nw/w, nh/h);
+            free(label_boxes);
         } else {
-            nw = scale * w;
-            nh = nw / new_ar;
+            fill_truth_detection(path, boxes, y, classes, flip, -dx/w, -dy/h, nw/w, nh/h);
         }
+    }
 
-        float dx = rand_uniform(0, w - nw);
-        float dy = rand_uniform(0, h - nh);
+    if(!shards) release_image_cached(orig, ref);
+}
 
-        place_image(orig, nw, nh, dx, dy, sized);
+data load_data_detection(int n, char **paths, int m, label_set *labels, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+{
+    char **random_paths = get_random_paths(paths, n, m);
+    int i;
+    data d = {0};
+    d.shallow = 0;
 
-        random_distort_image(sized, hue, saturation, exposure);
+    d.X.rows = n;
+    d.X.vals = calloc(d.X.rows, sizeof(float*));
+    d.X.cols = h*w*3;
 
-        int flip = rand()%2;
-        if(flip) flip_image(sized);
-        d.X.vals[i] = sized.data;
+    d.y = make_matrix(n, 5*boxes);
+    for(i = 0; i < n; ++i){
+        d.X.vals[i] = calloc(d.X.cols, sizeof(float));
+        load_detection_sample(random_paths[i], 0, 0, labels, d.X.vals[i], d.y.vals[i], w, h, boxes, classes, jitter, hue, saturation, exposure);
+    }
+    free(random_paths);
+    return d;
+}
 
+/*
+输入：分片集合 shards，样本序号 indexes(为0时随机选取)，其他参数与 load_data_detection 相同
+功能：从分片中取 n 个样本，做与 load_data_detection 相同的数据增强
+*/
+data load_data_detection_shards(shard_set *shards, int *indexes, int n, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+{
+    int *random_indexes = indexes ? 0 : get_random_indexes(n, shards->count);
+    if(!indexes) indexes = random_indexes;
+    int i;
+    data d = {0};
+    d.shallow = 0;
 
-        fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+    d.X.rows = n;
+    d.X.vals = calloc(d.X.rows, sizeof(float*));
+    d.X.cols = h*w*3;
 
-        free_image(orig);
+    d.y = make_matrix(n, 5*boxes);
+    for(i = 0; i < n; ++i){
+        d.X.vals[i] = calloc(d.X.cols, sizeof(float));
+        load_detection_sample(0, shards, indexes[i], 0, d.X.vals[i], d.y.vals[i], w, h, boxes, classes, jitter, hue, saturation, exposure);
     }
-    free(random_paths);
+    free(random_indexes);
     return d;
 }
 
-void *load_thread(void *ptr)
+/*
+输入：加载参数 a
+功能：按 a.type 加载数据，结果写入 *a.d (IMAGE_DATA、LETTERBOX_DATA 写入 *a.im 和 *a.resized)
+*/
+static void load_args_run(load_args a)
 {
-    //printf("Loading data: %d\n", rand());
-    load_args a = *(struct load_args*)ptr;
     if(a.exposure == 0) a.exposure = 1;
     if(a.saturation == 0) a.saturation = 1;
     if(a.aspect == 0) a.aspect = 1;
 
+    if(a.sampler && (a.paths || a.shards)){
+        // 先由采样器选出样本，再按 m=0(按顺序使用给出的路径)加载
+        int count = (a.type == COMPARE_DATA) ? 2*a.n : a.n;
+        int *indexes = calloc(count, sizeof(int));
+        sampler_next(a.sampler, indexes, count);
+        if(a.type == SHARD_DETECTION_DATA){
+            *a.d = load_data_detection_shards(a.shards, indexes, a.n, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+        } else {
+            int i;
+            char **paths = calloc(count, sizeof(char*));
+            for(i = 0; i < count; ++i) paths[i] = a.paths[indexes[i]];
+            load_args b = a;
+            b.sampler = 0;
+            b.paths = paths;
+            b.m = 0;
+            load_args_run(b);
+            free(paths);
+        }
+        free(indexes);
+        return;
+    }
+
     if (a.type == OLD_CLASSIFICATION_DATA){
         *a.d = load_data_old(a.paths, a.n, a.m, a.labels, a.classes, a.w, a.h);
     } else if (a.type == REGRESSION_DATA){
@@ -1123,7 +1442,9 @@ void *load_thread(void *ptr)
     } else if (a.type == REGION_DATA){
         *a.d = load_data_region(a.n, a.paths, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
     } else if (a.type == DETECTION_DATA){
-        *a.d = load_data_detection(a.n, a.paths, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+        *a.d = load_data_detection(a.n, a.paths, a.m, a.label_set, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+    } else if (a.type == SHARD_DETECTION_DATA){
+        *a.d = load_data_detection_shards(a.shards, 0, a.n, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
     } else if (a.type == SWAG_DATA){
         *a.d = load_data_swag(a.paths, a.n, a.classes, a.jitter);
     } else if (a.type == COMPARE_DATA){
@@ -1132,11 +1453,19 @@ void *load_thread(void *ptr)
         *(a.im) = load_image_color(a.path, 0, 0);
         *(a.resized) = resize_image(*(a.im), a.w, a.h);
     } else if (a.type == LETTERBOX_DATA){
-        *(a.im) = load_image_color(a.path, 0, 0);
+        if(a.im_size) *(a.im) = load_image_reduced(a.path, a.w, a.h, 3, a.im_size, a.im_size + 1);
+        else *(a.im) = load_image_color(a.path, 0, 0);
         *(a.resized) = letterbox_image(*(a.im), a.w, a.h);
     } else if (a.type == TAG_DATA){
         *a.d = load_data_tag(a.paths, a.n, a.m, a.classes, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure);
     }
+}
+
+void *load_thread(void *ptr)
+{
+    //printf("Loading data: %d\n", rand());
+    load_args a = *(struct load_args*)ptr;
+    load_args_run(a);
     free(ptr);
     return 0;
 }
@@ -1150,32 +1479,184 @@ pthread_t load_data_in_thread(load_args args)
     return thread;
 }
 
-void *load_threads(void *ptr)
+/*
+常驻的数据加载线程池：
+    每个 batch 按线程数切分成若干个任务放进队列，由常驻的工作线程取出执行，避免每个 batch 都创建、回收 args.threads 个线程。
+    同一个 batch 的任务共用一个 load_batch，全部完成之后通知等待的线程。
+    任务的 dst 不为0时，工作线程直接把数据写到 dst 中从 offset 开始的行(data_loader 预先分配的 batch)，
+    否则写到 args.d 中，由等待的线程按顺序拼接(兼容 load_data)。
+*/
+typedef struct load_batch{
+    int remaining;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+} load_batch;
+
+typedef struct load_job{
+    load_args args;
+    data *dst;
+    int offset;
+    load_batch *batch;
+    struct load_job *next;
+} load_job;
+
+static pthread_mutex_t load_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_pool_cond = PTHREAD_COND_INITIALIZER;
+static load_job *load_pool_head = 0;
+static load_job *load_pool_tail = 0;
+static int load_pool_workers = 0;
+
+static void load_batch_init(load_batch *b, int n)
+{
+    b->remaining = n;
+    pthread_mutex_init(&b->mutex, 0);
+    pthread_cond_init(&b->done, 0);
+}
+
+static void load_batch_wait(load_batch *b)
+{
+    pthread_mutex_lock(&b->mutex);
+    while(b->remaining > 0) pthread_cond_wait(&b->done, &b->mutex);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static void load_batch_destroy(load_batch *b)
+{
+    pthread_mutex_destroy(&b->mutex);
+    pthread_cond_destroy(&b->done);
+}
+
+/*
+输入：任务 job
+功能：执行一个任务，结果直接写入 job->dst 中从 job->offset 开始的 job->args.n 行。
+     检测数据逐张直接写进 dst 预先分配好的行；其他类型先按原来的方式加载，再把行指针放进 dst，原来 dst 中的行由 dst 释放
+*/
+static void load_job_run(load_job *job)
+{
+    load_args a = job->args;
+    data *dst = job->dst;
+    int i;
+    if(a.type == DETECTION_DATA || a.type == SHARD_DETECTION_DATA){
+        int *indexes;
+        if(a.sampler){
+            indexes = calloc(a.n, sizeof(int));
+            sampler_next(a.sampler, indexes, a.n);
+        } else {
+            indexes = get_random_indexes(a.n, a.shards ? a.shards->count : a.m);
+        }
+        for(i = 0; i < a.n; ++i){
+            float *y = dst->y.vals[job->offset + i];
+            memset(y, 0, dst->y.cols*sizeof(float));
+            if(a.shards) load_detection_sample(0, a.shards, indexes[i], 0, dst->X.vals[job->offset + i], y, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+            else load_detection_sample(a.paths[indexes[i]], 0, 0, a.label_set, dst->X.vals[job->offset + i], y, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+        }
+        free(indexes);
+        return;
+    }
+    data d = {0};
+    a.d = &d;
+    load_args_run(a);
+    for(i = 0; i < d.X.rows; ++i){
+        dst->X.vals[job->offset + i] = d.X.vals[i];
+        dst->y.vals[job->offset + i] = d.y.vals[i];
+    }
+    if(job->offset == 0){
+        dst->X.cols = d.X.cols;
+        dst->y.cols = d.y.cols;
+        dst->w = d.w;
+        dst->h = d.h;
+    }
+    free(d.X.vals);
+    free(d.y.vals);
+}
+
+static void *load_pool_worker(void *ptr)
+{
+    while(1){
+        pthread_mutex_lock(&load_pool_mutex);
+        while(!load_pool_head) pthread_cond_wait(&load_pool_cond, &load_pool_mutex);
+        load_job *job = load_pool_head;
+        load_pool_head = job->next;
+        if(!load_pool_head) load_pool_tail = 0;
+        pthread_mutex_unlock(&load_pool_mutex);
+
+        if(job->dst) load_job_run(job);
+        else load_args_run(job->args);
+
+        load_batch *b = job->batch;
+        free(job);
+        pthread_mutex_lock(&b->mutex);
+        if(--b->remaining == 0) pthread_cond_broadcast(&b->done);
+        pthread_mutex_unlock(&b->mutex);
+    }
+    return 0;
+}
+
+/*
+输入：加载参数 args，args.n 个样本按 args.threads 切分成任务，batch 为这些任务共用的计数
+功能：把一个 batch 的任务放进线程池的队列，线程池中的线程不足 args.threads 个时补足。不等待任务完成
+     dst 不为0时结果写入 dst，否则第 i 个任务写入 buffers[i]
+*/
+static void load_pool_submit(load_args args, data *dst, data *buffers, load_batch *batch)
 {
     int i;
+    int total = args.n;
+    pthread_mutex_lock(&load_pool_mutex);
+    while(load_pool_workers < args.threads){
+        pthread_t thread;
+        if(pthread_create(&thread, 0, load_pool_worker, 0)) error("Thread creation failed");
+        pthread_detach(thread);
+        ++load_pool_workers;
+    }
+    for(i = 0; i < args.threads; ++i){
+        load_job *job = calloc(1, sizeof(load_job));
+        job->args = args;
+        job->args.n = (i+1) * total/args.threads - i * total/args.threads;
+        job->offset = i * total/args.threads;
+        job->dst = dst;
+        if(!dst) job->args.d = buffers + i;
+        job->batch = batch;
+        if(load_pool_tail) load_pool_tail->next = job;
+        else load_pool_head = job;
+        load_pool_tail = job;
+    }
+    pthread_cond_broadcast(&load_pool_cond);
+    pthread_mutex_unlock(&load_pool_mutex);
+}
+
+void *load_threads(void *ptr)
+{
+    int i, j;
     load_args args = *(load_args *)ptr;
     if (args.threads == 0) args.threads = 1;
     data *out = args.d;
-    int total = args.n;
     free(ptr);
     data *buffers = calloc(args.threads, sizeof(data));
-    pthread_t *threads = calloc(args.threads, sizeof(pthread_t));
-    for(i = 0; i < args.threads; ++i){
-        args.d = buffers + i;
-        args.n = (i+1) * total/args.threads - i * total/args.threads;
-        threads[i] = load_data_in_thread(args);
-    }
+    load_batch batch;
+    load_batch_init(&batch, args.threads);
+    load_pool_submit(args, 0, buffers, &batch);
+    load_batch_wait(&batch);
+    load_batch_destroy(&batch);
+
+    // 按顺序把各个任务的行指针放到一起，行的内存交给 out
+    data d = buffers[0];
+    d.shallow = 0;
+    d.X.rows = d.y.rows = 0;
     for(i = 0; i < args.threads; ++i){
-        pthread_join(threads[i], 0);
+        d.X.rows += buffers[i].X.rows;
+        d.y.rows += buffers[i].y.rows;
     }
-    *out = concat_datas(buffers, args.threads);
-    out->shallow = 0;
+    d.X.vals = calloc(d.X.rows, sizeof(float *));
+    d.y.vals = calloc(d.y.rows, sizeof(float *));
+    int xr = 0, yr = 0;
     for(i = 0; i < args.threads; ++i){
+        for(j = 0; j < buffers[i].X.rows; ++j) d.X.vals[xr++] = buffers[i].X.vals[j];
+        for(j = 0; j < buffers[i].y.rows; ++j) d.y.vals[yr++] = buffers[i].y.vals[j];
         buffers[i].shallow = 1;
         free_data(buffers[i]);
     }
+    *out = d;
     free(buffers);
-    free(threads);
     return 0;
 }
 
@@ -1195,6 +1676,149 @@ pthread_t load_data(load_args args)
     return thread;
 }
 
+/*
+长期运行的数据加载器：
+    depth 个预先分配好的 batch 组成环形队列，空闲的 batch 立即交给线程池加载，
+    data_loader_next 按顺序取出下一个加载完成的 batch，同时把上一次取出的 batch 放回去重新加载。
+*/
+struct data_loader{
+    load_args args;
+    int depth;
+    int next;        // 下一个要取出的 batch
+    int taken;       // 上一次取出、还在被使用的 batch，-1 表示没有
+    data *slots;
+    load_batch *batches;
+    int count;          // 已经取出的 batch 个数
+    int stalls;         // 取出时还没有加载完、需要等待的次数
+    double stall_time;  // 等待加载的总时间(秒)
+};
+
+static void data_loader_slot_alloc(data_loader *dl, data *d)
+{
+    load_args a = dl->args;
+    int i;
+    d->shallow = 0;
+    d->X.rows = d->y.rows = a.n;
+    d->X.vals = calloc(a.n, sizeof(float *));
+    d->y.vals = calloc(a.n, sizeof(float *));
+    if(a.type == DETECTION_DATA || a.type == SHARD_DETECTION_DATA){
+        // 检测数据每次大小相同，整个 batch 的输入和标签各分配一块连续内存，之后一直复用
+        d->X.cols = a.w*a.h*3;
+        d->y.cols = 5*a.num_boxes;
+        float *x = calloc((size_t)a.n*d->X.cols, sizeof(float));
+        float *y = calloc((size_t)a.n*d->y.cols, sizeof(float));
+        if(!x || !y) malloc_error();
+        for(i = 0; i < a.n; ++i){
+            d->X.vals[i] = x + (size_t)i*d->X.cols;
+            d->y.vals[i] = y + (size_t)i*d->y.cols;
+        }
+    }
+}
+
+// 释放 batch 中每一行的内存：检测数据的行是连续分配并复用的，其他类型的行由加载函数逐行分配
+static void data_loader_slot_clear(data_loader *dl, data *d, int all)
+{
+    int i;
+    if(dl->args.type == DETECTION_DATA || dl->args.type == SHARD_DETECTION_DATA){
+        if(!all) return;
+        free(d->X.vals[0]);
+        free(d->y.vals[0]);
+    } else {
+        for(i = 0; i < d->X.rows; ++i){
+            free(d->X.vals[i]);
+            free(d->y.vals[i]);
+            d->X.vals[i] = d->y.vals[i] = 0;
+        }
+    }
+    if(all){
+        free(d->X.vals);
+        free(d->y.vals);
+    }
+}
+
+static void data_loader_submit(data_loader *dl, int i)
+{
+    data_loader_slot_clear(dl, dl->slots + i, 0);
+    load_batch_init(dl->batches + i, dl->args.threads);
+    load_pool_submit(dl->args, dl->slots + i, 0, dl->batches + i);
+}
+
+/*
+输入：加载参数 args（args.d 不使用），环形队列中 batch 的个数 depth
+功能：创建数据加载器，立即开始加载 depth 个 batch
+返回：数据加载器，用 free_data_loader 释放
+*/
+data_loader *make_data_loader(load_args args, int depth)
+{
+    int i;
+    if(args.threads == 0) args.threads = 1;
+    if(args.threads > args.n) args.threads = args.n;
+    if(depth < 1) depth = 1;
+    data_loader *dl = calloc(1, sizeof(data_loader));
+    dl->args = args;
+    dl->depth = depth;
+    dl->taken = -1;
+    dl->slots = calloc(depth, sizeof(data));
+    dl->batches = calloc(depth, sizeof(load_batch));
+    for(i = 0; i < depth; ++i){
+        data_loader_slot_alloc(dl, dl->slots + i);
+        data_loader_submit(dl, i);
+    }
+    return dl;
+}
+
+/*
+输入：数据加载器 dl
+功能：等待并取出下一个 batch，并把上一次取出的 batch 放回去重新加载。
+     返回的数据属于加载器，只在下一次调用 data_loader_next 之前有效，不能 free_data
+返回：一个 batch 的数据
+*/
+data data_loader_next(data_loader *dl)
+{
+    if(dl->taken >= 0) data_loader_submit(dl, dl->taken);
+    int i = dl->next;
+    load_batch *b = dl->batches + i;
+    pthread_mutex_lock(&b->mutex);
+    int ready = b->remaining == 0;
+    pthread_mutex_unlock(&b->mutex);
+    if(!ready){
+        double start = what_time_is_it_now();
+        load_batch_wait(b);
+        dl->stall_time += what_time_is_it_now() - start;
+        ++dl->stalls;
+    }
+    ++dl->count;
+    load_batch_destroy(dl->batches + i);
+    dl->taken = i;
+    dl->next = (i + 1) % dl->depth;
+    return dl->slots[i];
+}
+
+/*
+输入：数据加载器 dl
+功能：取出 dl 的统计：已经取出的 batch 个数、其中需要等待加载的次数以及等待的总时间，不需要的参数可以为0
+*/
+void data_loader_stats(data_loader *dl, int *count, int *stalls, double *stall_time)
+{
+    if(count) *count = dl->count;
+    if(stalls) *stalls = dl->stalls;
+    if(stall_time) *stall_time = dl->stall_time;
+}
+
+void free_data_loader(data_loader *dl)
+{
+    int i;
+    for(i = 0; i < dl->depth; ++i){
+        if(i == dl->taken) continue;
+        load_batch_wait(dl->batches + i);
+        load_batch_destroy(dl->batches + i);
+    }
+    for(i = 0; i < dl->depth; ++i) data_loader_slot_clear(dl, dl->slots + i, 1);
+    free(dl->slots);
+    free(dl->batches);
+    free(dl);
+}
+
 data load_data_writing(char **paths, int n, int m, int w, int h, int out_w, int out_h)
 {
     if(m) paths = get_random_paths(paths, n, m);
@@ -1251,7 +1875,7 @@ data load_data_super(char **paths, int n, int m, int w, int h, int scale)
     d.y.cols = w*scale * h*scale * 3;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        image im = load_image_cached(paths[i], 0, 0);
         image crop = random_crop_image(im, w*scale, h*scale);
         int flip = rand()%2;
         if (flip) flip_image(crop);
@@ -1475,6 +2099,36 @@ void get_next_batch(data d, int n, int offset, float *X, float *y)
     }
 }
 
+static int rows_contiguous(matrix m, int n, int offset)
+{
+    int j;
+    if(!m.vals || offset + n > m.rows) return 0;
+    for(j = 1; j < n; ++j){
+        if(m.vals[offset + j] != m.vals[offset] + (size_t)j*m.cols) return 0;
+    }
+    return 1;
+}
+
+/*
+输入：数据 d，行数 n，起始行 offset，
+     网络的输入缓冲 X 和标签缓冲 y（y 为0时不需要标签）
+功能：取出从 offset 开始的 n 行数据作为网络一次前向计算的输入：
+     如果这 n 行输入(以及标签)本身就是一块连续内存(data_loader 中的检测数据)，直接返回它们的地址，不做拷贝，
+     否则按 get_next_batch 拷贝到 X、y 中
+输出：*X、*y 指向这 n 行数据，在 d 被释放或重新加载之前有效
+*/
+void get_next_batch_view(data d, int n, int offset, float **X, float **y)
+{
+    int x_view = rows_contiguous(d.X, n, offset);
+    int y_view = !*y || rows_contiguous(d.y, n, offset);
+    if(x_view && y_view){
+        *X = d.X.vals[offset];
+        if(*y) *y = d.y.vals[offset];
+        return;
+    }
+    get_next_batch(d, n, offset, *X, *y);
+}
+
 void smooth_data(data d)
 {
     int i, j;
@@ -24,7 +24,9 @@ void load_data_blocking(load_args args);
 void print_letters(float *pred, int n);
 data load_data_captcha(char **paths, int n, int m, int k, int w, int h);
 data load_data_captcha_encode(char **paths, int n, int m, int w, int h);
-data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure);
+data load_data_detection(int n, char **paths, int m, label_set *labels, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure);
+data load_data_detection_shards(shard_set *shards, int *indexes, int n, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure);
+void detection_label_path(char *path, char *labelpath);
 data load_data_tag(char **paths, int n, int m, int k, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure);
 matrix load_image_augment_paths(char **paths, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center);
 data load_data_super(char **paths, int n, int m, int w, int h, int scale);
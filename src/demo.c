@@ -78,8 +78,9 @@ detection *avg_predictions(network *net, int *nboxes)
             count += l.outputs;
         }
     }
-    detection *dets = get_network_boxes(net, buff[0].w, buff[0].h, demo_thresh, demo_hier, 0, 1, nboxes);
-    return dets;
+    detection_batch *b = get_network_detections(net, buff[0].w, buff[0].h, demo_thresh, demo_hier, 0, 1);
+    *nboxes = b->n;
+    return detection_batch_dets(b);
 }
 
 void *detect_in_thread(void *ptr)
@@ -130,7 +131,6 @@ void *detect_in_thread(void *ptr)
     printf("Objects:\n\n");
     image display = buff[(buff_index+2) % 3];
     draw_detections(display, dets, nboxes, demo_thresh, demo_names, demo_alphabet, demo_classes);
-    free_detections(dets, nboxes);
 
     demo_index = (demo_index + 1)%demo_frame;
     running = 0;
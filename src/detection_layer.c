@@ -11,7 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-detection_layer make_detection_layer(int batch, int inputs, int n, int side, int classes, int coords, int rescore)
+detection_layer make_detection_layer(int batch, int inputs, int n, int side, int classes, int coords, int rescore, int inference)
 {
     detection_layer l = {0};
     l.type = DETECTION;
@@ -30,7 +30,7 @@ detection_layer make_detection_layer(int batch, int inputs, int n, int side, int
     l.outputs = l.inputs;
     l.truths = l.side*l.side*(1+l.coords+l.classes);
     l.output = calloc(batch*l.outputs, sizeof(float));
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(!inference) l.delta = calloc(batch*l.outputs, sizeof(float));
 
     l.forward = forward_detection_layer;
     l.backward = backward_detection_layer;
@@ -6,7 +6,7 @@
 
 typedef layer dropout_layer;
 
-dropout_layer make_dropout_layer(int batch, int inputs, float probability);
+dropout_layer make_dropout_layer(int batch, int inputs, float probability, int inference);
 
 void forward_dropout_layer(dropout_layer l, network net);
 void backward_dropout_layer(dropout_layer l, network net);
@@ -1,6 +1,8 @@
 #include "gemm.h"
 #include "utils.h"
 #include "cuda.h"
+#include "simd.h"
+#include "im2col.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
@@ -252,17 +254,369 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
-void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+/*
+分块打包的gemm实现（参考GotoBLAS/BLIS的做法）：
+    GEMM_NC 矩阵B按列分块的大小，一个 kc*nc 的B块常驻L3缓存
+    GEMM_KC 矩阵A、B沿K方向分块的大小，一个 kc*nr 的B条带常驻L1缓存
+    GEMM_MC 矩阵A按行分块的大小，一个 mc*kc 的A块常驻L2缓存
+    mr、nr 微内核(microkernel)一次在寄存器中计算的C子块大小，由 simd.c 根据CPU特性在运行时选择，
+    没有可用的向量化微内核时使用下面的通用微内核，大小为 GEMM_MR*GEMM_NR
+打包时把A、B中需要的元素按微内核读取的顺序连续存放，这样无论是否转置，微内核看到的都是同一种连续的数据排布，
+所以 gemm_nn/nt/tn/tt 四种情况只需要在打包的时候处理行列步长即可。
+GEMM_MC、GEMM_NC 需要分别是所有微内核 mr、nr 的整数倍。
+*/
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_MC 120
+#define GEMM_KC 256
+#define GEMM_NC 4096
+// M*N*K小于该值时打包的开销不划算，直接使用上面的朴素实现
+#define GEMM_SMALL (32*32*32)
+
+typedef void (*gemm_kernel_func)(int kc, float *a, float *b, float *c, int ldc, int accumulate, const gemm_epilogue *ep);
+
+/*
+输入：*C 矩阵C的首地址
+     ldc 矩阵*C一行有多少个元素
+     rows,cols 需要处理的行数与列数
+     *ep 尾处理，指针已经偏移到第一行
+功能：对C中 rows*cols 的部分按行做尾处理 C = act(C*scales + biases)，用于通用微内核、边缘子块以及不走打包路径的小矩阵
+输出：尾处理后的C
+返回：无
+*/
+void gemm_apply_epilogue(float *C, int ldc, int rows, int cols, const gemm_epilogue *ep)
+{
+    int i, j;
+    for(i = 0; i < rows; ++i){
+        float *c = C + (size_t)i*ldc;
+        if(ep->scales){
+            float s = ep->scales[i];
+            for(j = 0; j < cols; ++j) c[j] *= s;
+        }
+        if(ep->biases){
+            float b = ep->biases[i];
+            for(j = 0; j < cols; ++j) c[j] += b;
+        }
+        if(ep->activation != LINEAR) activate_array(c, cols, ep->activation);
+    }
+}
+
+/*
+输入：mc,kc 要打包的A块的行数和列数
+     ALPHA 广义矩阵乘积操作(gemm)参数，打包的时候顺便乘上
+     *A A块的首地址
+     rsa,csa A块的行步长和列步长，即A(i,p) = A[i*rsa + p*csa]
+     MR 微内核的行数
+     *pack 打包后的数据
+功能：将A块按 MR 行一组打包，每组内按列优先连续存放，不足 MR 行的部分补零
+输出：打包后的A块 *pack
+返回：无
+*/
+static void gemm_pack_a(int mc, int kc, float ALPHA, float *A, int rsa, int csa, int MR, float *pack)
+{
+    int ir;
+    #pragma omp parallel for
+    for(ir = 0; ir < mc; ir += MR){
+        int i, p;
+        int mr = (mc - ir < MR) ? mc - ir : MR;
+        float *a = A + ir*rsa;
+        float *dst = pack + ir*kc;
+        for(p = 0; p < kc; ++p){
+            for(i = 0; i < mr; ++i) dst[p*MR + i] = ALPHA*a[i*rsa + p*csa];
+            for(; i < MR; ++i) dst[p*MR + i] = 0;
+        }
+    }
+}
+
+/*
+输入：kc,nc 要打包的B块的行数和列数
+     *B B块的首地址
+     rsb,csb B块的行步长和列步长，即B(p,j) = B[p*rsb + j*csb]
+     NR 微内核的列数
+     *pack 打包后的数据
+功能：将B块按 NR 列一组打包，每组内按行优先连续存放，不足 NR 列的部分补零
+输出：打包后的B块 *pack
+返回：无
+*/
+static void gemm_pack_b(int kc, int nc, float *B, int rsb, int csb, int NR, float *pack)
+{
+    int jr;
+    #pragma omp parallel for
+    for(jr = 0; jr < nc; jr += NR){
+        int j, p;
+        int nr = (nc - jr < NR) ? nc - jr : NR;
+        float *b = B + jr*csb;
+        float *dst = pack + jr*kc;
+        for(p = 0; p < kc; ++p){
+            for(j = 0; j < nr; ++j) dst[p*NR + j] = b[p*rsb + j*csb];
+            for(; j < NR; ++j) dst[p*NR + j] = 0;
+        }
+    }
+}
+
+/*
+输入：kc 打包后A、B条带的长度
+     *a 打包后的 GEMM_MR*kc 的A条带
+     *b 打包后的 kc*GEMM_NR 的B条带
+     *c C子块的首地址
+     ldc 矩阵*C一行有多少个元素
+     accumulate 为0时直接写回C，否则加到C上
+     *ep 尾处理，为0时不做
+功能：通用微内核，在局部数组中累加 GEMM_MR*GEMM_NR 的C子块，编译器会将其放到向量寄存器中，最后一次性写回C
+输出：C = a*b 或 C += a*b，并做尾处理
+返回：无
+*/
+static void gemm_kernel(int kc, float *a, float *b, float *c, int ldc, int accumulate, const gemm_epilogue *ep)
+{
+    int j, p;
+    // 每一行一个累加数组，内层按列循环，便于编译器把累加结果保存在向量寄存器中
+    float c0[GEMM_NR] = {0}, c1[GEMM_NR] = {0}, c2[GEMM_NR] = {0};
+    float c3[GEMM_NR] = {0}, c4[GEMM_NR] = {0}, c5[GEMM_NR] = {0};
+    for(p = 0; p < kc; ++p){
+        float a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4], a5 = a[5];
+        for(j = 0; j < GEMM_NR; ++j){
+            c0[j] += a0*b[j];
+            c1[j] += a1*b[j];
+            c2[j] += a2*b[j];
+            c3[j] += a3*b[j];
+            c4[j] += a4*b[j];
+            c5[j] += a5*b[j];
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    if(accumulate){
+        for(j = 0; j < GEMM_NR; ++j){
+            c[0*ldc + j] += c0[j];
+            c[1*ldc + j] += c1[j];
+            c[2*ldc + j] += c2[j];
+            c[3*ldc + j] += c3[j];
+            c[4*ldc + j] += c4[j];
+            c[5*ldc + j] += c5[j];
+        }
+    } else {
+        for(j = 0; j < GEMM_NR; ++j){
+            c[0*ldc + j] = c0[j];
+            c[1*ldc + j] = c1[j];
+            c[2*ldc + j] = c2[j];
+            c[3*ldc + j] = c3[j];
+            c[4*ldc + j] = c4[j];
+            c[5*ldc + j] = c5[j];
+        }
+    }
+    // 子块刚写回，还在L1缓存中
+    if(ep) gemm_apply_epilogue(c, ldc, GEMM_MR, GEMM_NR, ep);
+}
+
+/*
+输入：mc,nc,kc 当前A块的行数、B块的列数、K方向分块大小
+     *apack,*bpack 打包后的A块和B块
+     *C C块的首地址
+     ldc 矩阵*C一行有多少个元素
+     kernel,MR,NR 微内核及其计算的子块大小
+     accumulate 为0时直接写回C，否则加到C上
+     *ep 尾处理，为0时不做，指针偏移到C块的第一行
+功能：宏内核，对打包后的A块与B块，按 MR*NR 的子块调用微内核，边缘不足一个子块的部分先算到临时子块中再写回C
+输出：C = apack*bpack 或 C += apack*bpack，并做尾处理
+返回：无
+*/
+static void gemm_macro_kernel(int mc, int nc, int kc, float *apack, float *bpack, float *C, int ldc,
+        gemm_kernel_func kernel, int MR, int NR, int accumulate, const gemm_epilogue *ep)
+{
+    int jr;
+    #pragma omp parallel for
+    for(jr = 0; jr < nc; jr += NR){
+        int ir, i, j;
+        int nr = (nc - jr < NR) ? nc - jr : NR;
+        for(ir = 0; ir < mc; ir += MR){
+            int mr = (mc - ir < MR) ? mc - ir : MR;
+            float *c = C + ir*ldc + jr;
+            // 尾处理的系数和偏置偏移到当前子块的第一行
+            gemm_epilogue tile, *tep = 0;
+            if(ep){
+                tile = *ep;
+                if(tile.scales) tile.scales += ir;
+                if(tile.biases) tile.biases += ir;
+                tep = &tile;
+            }
+            if(mr == MR && nr == NR){
+                kernel(kc, apack + ir*kc, bpack + jr*kc, c, ldc, accumulate, tep);
+            } else {
+                float tmp[SIMD_MAX_MR*SIMD_MAX_NR];
+                kernel(kc, apack + ir*kc, bpack + jr*kc, tmp, NR, 0, 0);
+                for(i = 0; i < mr; ++i){
+                    for(j = 0; j < nr; ++j){
+                        c[i*ldc + j] = accumulate ? c[i*ldc + j] + tmp[i*NR + j] : tmp[i*NR + j];
+                    }
+                }
+                if(tep) gemm_apply_epilogue(c, ldc, mr, nr, tep);
+            }
+        }
+    }
+}
+
+/*
+隐式im2col时B矩阵的来源，B即为输入im经过im2col之后的矩阵，打包时直接从im中取数
+*/
+typedef struct{
+    float *im;
+    int channels;
+    int height;
+    int width;
+    int ksize;
+    int stride;
+    int pad;
+} gemm_conv_source;
+
+/*
+输入：TA,M,N,K,ALPHA,A,lda,C,ldc 与gemm_cpu相同
+     *B,rsb,csb 矩阵B及其行步长和列步长，即B(p,j) = B[p*rsb + j*csb]
+     *conv 不为0时，B为 conv->im 的im2col矩阵，不使用 B,rsb,csb
+     BETA 为0时不读取C原来的值，直接写回
+     *ep 尾处理，为0时不做，在K方向最后一个分块写回C时完成
+功能：分块打包的矩阵乘积 C = ep(ALPHA*op(A)*B + BETA*C)
+     三层分块循环依次为：B按列分成 GEMM_NC，K方向分成 GEMM_KC（打包B块），A按行分成 GEMM_MC（打包A块），再交给宏内核
+输出：C = ep(ALPHA*op(A)*B + BETA*C)
+返回：无
+*/
+static void gemm_packed_driver(int TA, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int rsb, int csb, gemm_conv_source *conv,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *ep)
+{
+    int jc, pc, ic;
+    if(BETA != 0 && BETA != 1){
+        int i, j;
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j) C[(size_t)i*ldc + j] *= BETA;
+        }
+        BETA = 1;
+    }
+    // 转置只影响行列步长
+    int rsa = TA ? 1 : lda;
+    int csa = TA ? lda : 1;
+
+    // 选择微内核，simd.gemm_kernel 为 0 时表示当前CPU没有向量化的微内核
+    gemm_kernel_func kernel = gemm_kernel;
+    int MR = GEMM_MR;
+    int NR = GEMM_NR;
+    if(simd.gemm_kernel){
+        kernel = simd.gemm_kernel;
+        MR = simd.gemm_mr;
+        NR = simd.gemm_nr;
+    }
+
+    int kmax = (K < GEMM_KC) ? K : GEMM_KC;
+    int mmax = (M < GEMM_MC) ? M : GEMM_MC;
+    int nmax = (N < GEMM_NC) ? N : GEMM_NC;
+    float *apack = calloc((size_t)((mmax + MR - 1)/MR)*MR*kmax, sizeof(float));
+    float *bpack = calloc((size_t)((nmax + NR - 1)/NR)*NR*kmax, sizeof(float));
+
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            if(conv){
+                im2col_pack_cpu(conv->im, conv->channels, conv->height, conv->width,
+                        conv->ksize, conv->stride, conv->pad, pc, kc, jc, nc, NR, bpack);
+            } else {
+                gemm_pack_b(kc, nc, B + (size_t)pc*rsb + (size_t)jc*csb, rsb, csb, NR, bpack);
+            }
+            // K方向第一个分块按BETA决定是否累加，最后一个分块写回时做尾处理
+            int accumulate = (pc > 0) || (BETA != 0);
+            int last = (pc + kc >= K);
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                gemm_epilogue block, *bep = 0;
+                if(ep && last){
+                    block = *ep;
+                    if(block.scales) block.scales += ic;
+                    if(block.biases) block.biases += ic;
+                    bep = &block;
+                }
+                gemm_pack_a(mc, kc, ALPHA, A + (size_t)ic*rsa + (size_t)pc*csa, rsa, csa, MR, apack);
+                gemm_macro_kernel(mc, nc, kc, apack, bpack, C + (size_t)ic*ldc + jc, ldc, kernel, MR, NR, accumulate, bep);
+            }
+        }
+    }
+    free(apack);
+    free(bpack);
+}
+
+/*
+输入：与gemm_cpu相同，BETA已经在gemm_cpu中乘过
+功能：分块打包的矩阵乘积 C += ALPHA*op(A)*op(B)，op表示根据TA、TB决定是否转置
+输出：C += ALPHA*op(A)*op(B)
+返回：无
+*/
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
-        float BETA,
         float *C, int ldc)
+{
+    int rsb = TB ? 1 : ldb;
+    int csb = TB ? ldb : 1;
+    gemm_packed_driver(TA, M, N, K, ALPHA, A, lda, B, rsb, csb, 0, 1, C, ldc, 0);
+}
+
+/*
+输入：M 每组filters的数量
+     N 每次卷积输出的高和宽的乘积
+     K 将卷积核分组后，每个卷积核的参数总数
+     ALPHA 广义矩阵乘积操作(gemm)参数
+     *A 权重，大小为 M*K
+     lda 矩阵*A一行有多少个元素
+     *im 当前样本当前组的输入数据
+     channels,height,width,ksize,stride,pad 与 im2col_cpu 的参数相同
+     BETA 广义矩阵乘积操作(gemm)参数，为0时不读取C原来的值
+     *C 卷积输出，大小为 M*N
+     ldc 矩阵*C一行有多少个元素
+     *ep 尾处理，为0时不做
+功能：隐式gemm卷积，结果与 im2col_cpu 之后再 gemm_fused_cpu(0,0,...) 相同，但im2col矩阵只在打包B块时按块生成，不需要 net.workspace
+输出：C = ep(ALPHA*A*im2col(im) + BETA*C)
+返回：无
+*/
+void gemm_conv_cpu(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *ep)
+{
+    gemm_conv_source conv = {im, channels, height, width, ksize, stride, pad};
+    gemm_packed_driver(0, M, N, K, ALPHA, A, lda, 0, 0, 0, &conv, BETA, C, ldc, ep);
+}
+
+
+/*
+输入：与gemm_cpu相同
+     *ep 写回C时的尾处理，为0时不做
+功能：C = ep(ALPHA*op(A)*op(B) + BETA*C)，BETA为0时不读取C原来的值，调用前不需要清零C
+输出：矩阵C
+返回：无
+*/
+void gemm_fused_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *ep)
 {
     //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
+    if((size_t)M*N*K >= GEMM_SMALL){
+        int rsb = TB ? 1 : ldb;
+        int csb = TB ? ldb : 1;
+        gemm_packed_driver(TA, M, N, K, ALPHA, A, lda, B, rsb, csb, 0, BETA, C, ldc, ep);
+        return;
+    }
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA; // 参考广义矩阵乘积操作(gemm)，这里的BETA为1
+            // 参考广义矩阵乘积操作(gemm)，BETA为0时C原来的值可能未初始化，直接置零
+            C[i*ldc + j] = BETA ? C[i*ldc + j]*BETA : 0;
         }
     }
     if(!TA && !TB) // 判断转置
@@ -273,6 +627,16 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_nt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
     else
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
+    if(ep) gemm_apply_epilogue(C, ldc, M, N, ep);
+}
+
+void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    gemm_fused_cpu(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc, 0);
 }
 
 #ifdef GPU
@@ -1,6 +1,19 @@
 #ifndef GEMM_H
 #define GEMM_H
 
+#include "activations.h"
+
+/*
+gemm 写回C时的尾处理(epilogue)，按C的行(卷积中即输出通道)进行：C[i][j] = act(C[i][j]*scales[i] + biases[i])
+scales、biases 为 0 时跳过对应的操作，activation 为 LINEAR 时不做激活。
+在微内核中C子块还在寄存器里的时候完成，省去 add_bias、scale_bias、activate_array 对输出的多次遍历
+*/
+typedef struct{
+    float *scales;
+    float *biases;
+    ACTIVATION activation;
+} gemm_epilogue;
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
@@ -18,6 +31,28 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_fused_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *ep);
+
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc);
+
+void gemm_conv_cpu(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *ep);
+
+void gemm_apply_epilogue(float *C, int ldc, int rows, int cols, const gemm_epilogue *ep);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -123,3 +123,55 @@ void im2col_cpu(float* data_im,
     }
 }
 
+
+/*
+输入：输入数据 data_im
+     输入数据的通道数channels、高度height、宽度width
+     卷积核大小ksize、步长stride、补零个数pad
+     row0,rows 要打包的子块在im2col矩阵中的起始行和行数（对应卷积核参数，即gemm中的K方向）
+     col0,cols 要打包的子块在im2col矩阵中的起始列和列数（对应输出的每一个位置，即gemm中的N方向）
+     NR gemm微内核的列数
+     输出pack
+功能：隐式im2col，不生成完整的im2col矩阵，直接从输入数据中取出im2col矩阵的一个 rows*cols 子块，
+     并按照gemm打包B矩阵的格式写入pack：每 NR 列为一组，组内按行连续存放，最后一组不足 NR 列的部分补零。
+     取出的元素与 im2col_cpu 完全相同，只是不再需要 l.out_h*l.out_w*l.size*l.size*l.c 大小的工作空间。
+输出：float *pack
+返回：无
+*/
+void im2col_pack_cpu(float *data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int row0, int rows, int col0, int cols, int NR, float *pack)
+{
+    int p;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int padded = (cols + NR - 1) / NR * NR;
+    #pragma omp parallel for
+    for (p = 0; p < rows; ++p) {
+        int c = row0 + p;
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        float *im = data_im + c_im*height*width;
+        // 当前输出位置(h, w)，随列号递增
+        int h = col0 / width_col;
+        int w = col0 % width_col;
+        int j;
+        for (j = 0; j < cols; ++j) {
+            int im_row = h_offset + h * stride - pad;
+            int im_col = w_offset + w * stride - pad;
+            float val = 0;
+            if (im_row >= 0 && im_col >= 0 && im_row < height && im_col < width) {
+                val = im[im_row*width + im_col];
+            }
+            pack[(j - j%NR)*rows + p*NR + j%NR] = val;
+            if (++w == width_col) {
+                w = 0;
+                ++h;
+            }
+        }
+        for (; j < padded; ++j) {
+            pack[(j - j%NR)*rows + p*NR + j%NR] = 0;
+        }
+    }
+}
@@ -5,6 +5,11 @@ void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
 
+void im2col_pack_cpu(float *data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int row0, int rows, int col0, int cols, int NR, float *pack);
+
 #ifdef GPU
 
 void im2col_gpu(float *im,
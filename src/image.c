@@ -10,6 +10,11 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#ifdef LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
 int windows = 0;
 
 float colors[6][3] = { {1,0,1}, {0,0,1},{0,1,1},{0,1,0},{1,1,0},{1,0,0} };
@@ -1192,6 +1197,168 @@ void random_distort_image(image im, float hue, float saturation, float exposure)
     distort_image(im, dhue, dsat, dexp);
 }
 
+/*
+输入：像素 rgb，色调偏移 hue，饱和度缩放 sat，亮度缩放 val
+功能：对单个像素做 distort_image 中的变换(rgb_to_hsv、缩放、色调偏移、hsv_to_rgb、限制到[0,1])，计算过程与之相同
+输出：rgb
+*/
+static inline void distort_pixel(float *rgb, float hue, float sat, float val)
+{
+    float r = rgb[0], g = rgb[1], b = rgb[2];
+    float h, s, v;
+    float max = three_way_max(r,g,b);
+    float min = three_way_min(r,g,b);
+    float delta = max - min;
+    v = max;
+    if(max == 0){
+        s = 0;
+        h = 0;
+    }else{
+        s = delta/max;
+        if(r == max){
+            h = (g - b) / delta;
+        } else if (g == max) {
+            h = 2 + (b - r) / delta;
+        } else {
+            h = 4 + (r - g) / delta;
+        }
+        if (h < 0) h += 6;
+        h = h/6.;
+    }
+    s = s*sat;
+    v = v*val;
+    h = h + hue;
+    if (h > 1) h -= 1;
+    if (h < 0) h += 1;
+
+    h = 6 * h;
+    if (s == 0) {
+        r = g = b = v;
+    } else {
+        int index = floor(h);
+        float f = h - index;
+        float p = v*(1-s);
+        float q = v*(1-s*f);
+        float t = v*(1-s*(1-f));
+        if(index == 0){
+            r = v; g = t; b = p;
+        } else if(index == 1){
+            r = q; g = v; b = p;
+        } else if(index == 2){
+            r = p; g = v; b = t;
+        } else if(index == 3){
+            r = p; g = q; b = v;
+        } else if(index == 4){
+            r = t; g = p; b = v;
+        } else {
+            r = v; g = p; b = q;
+        }
+    }
+    rgb[0] = (r < 0) ? 0 : (r > 1) ? 1 : r;
+    rgb[1] = (g < 0) ? 0 : (g > 1) ? 1 : g;
+    rgb[2] = (b < 0) ? 0 : (b > 1) ? 1 : b;
+}
+
+/*
+输入：3通道 uint8 图片 im，缩放后的大小 w,h，放置的位置 dx,dy，颜色扰动参数 hue,sat,val，是否水平翻转 flip，
+     3通道画布 canvas
+功能：一次遍历完成 fill_image(canvas, .5)、place_image(im, w, h, dx, dy, canvas)、distort_image(canvas, hue, sat, val)
+     以及 flip_image(canvas)，结果与依次调用这几个函数相同。
+     按输出的行处理：先按预先算好的列坐标表对一行做双线性插值，三个通道的结果放在行缓存中，
+     再逐像素做颜色变换并写到(翻转后的)输出位置，画布只写一次，不再反复读写整张图。
+     原图保持为 uint8，读取时才转换成 [0,1]，结果与先转换成 float 图像再处理相同
+输出：canvas
+*/
+void place_distort_image(image_u8 im, int w, int h, int dx, int dy, float hue, float sat, float val, int flip, image canvas)
+{
+    assert(im.c == 3 && canvas.c == 3);
+    int cw = canvas.w;
+    int ch = canvas.h;
+    int plane = cw*ch;
+    int x, y, k;
+
+    // uint8 到 [0,1] 的转换表，与 load_image 的转换结果相同
+    float norm[256];
+    for(k = 0; k < 256; ++k) norm[k] = k/255.;
+
+    // 背景(0.5的灰色)经过颜色变换之后的值，所有背景像素都相同
+    float fill[3] = {.5, .5, .5};
+    distort_pixel(fill, hue, sat, val);
+
+    // 画布每一列对应原图中的列坐标，不在放置范围内的列 ix 为 -1
+    int *ix = calloc(cw, sizeof(int));
+    float *fx = calloc(cw, sizeof(float));
+    for(x = 0; x < cw; ++x){
+        int px = x - dx;
+        if(px < 0 || px >= w){
+            ix[x] = -1;
+            continue;
+        }
+        float rx = ((float)px / w) * im.w;
+        ix[x] = (int) floorf(rx);
+        fx[x] = rx - ix[x];
+    }
+    float *row = calloc(3*cw, sizeof(float));
+
+    for(y = 0; y < ch; ++y){
+        float *out = canvas.data + y*cw;
+        int py = y - dy;
+        if(py < 0 || py >= h){
+            for(x = 0; x < cw; ++x){
+                out[x] = fill[0];
+                out[x + plane] = fill[1];
+                out[x + 2*plane] = fill[2];
+            }
+            continue;
+        }
+        float ry = ((float)py / h) * im.h;
+        int iy = (int) floorf(ry);
+        float fy = ry - iy;
+        int has_y1 = iy + 1 < im.h;
+
+        for(k = 0; k < 3; ++k){
+            float *r = row + k*cw;
+            unsigned char *src0 = im.data + (size_t)k*im.w*im.h + iy*im.w;
+            unsigned char *src1 = has_y1 ? src0 + im.w : 0;
+            for(x = 0; x < cw; ++x){
+                int i = ix[x];
+                if(i < 0) continue;
+                float ddx = fx[x];
+                int has_x1 = i + 1 < im.w;
+                float p00 = norm[src0[i]];
+                float p01 = src1 ? norm[src1[i]] : 0;
+                float p10 = has_x1 ? norm[src0[i+1]] : 0;
+                float p11 = (src1 && has_x1) ? norm[src1[i+1]] : 0;
+                r[x] = (1-fy) * (1-ddx) * p00 +
+                    fy     * (1-ddx) * p01 +
+                    (1-fy) *   ddx   * p10 +
+                    fy     *   ddx   * p11;
+            }
+        }
+
+        for(x = 0; x < cw; ++x){
+            int o = flip ? cw - 1 - x : x;
+            float rgb[3];
+            if(ix[x] < 0){
+                rgb[0] = fill[0];
+                rgb[1] = fill[1];
+                rgb[2] = fill[2];
+            } else {
+                rgb[0] = row[x];
+                rgb[1] = row[x + cw];
+                rgb[2] = row[x + 2*cw];
+                distort_pixel(rgb, hue, sat, val);
+            }
+            out[o] = rgb[0];
+            out[o + plane] = rgb[1];
+            out[o + 2*plane] = rgb[2];
+        }
+    }
+    free(row);
+    free(fx);
+    free(ix);
+}
+
 void saturate_exposure_image(image im, float sat, float exposure)
 {
     rgb_to_hsv(im);
@@ -1294,6 +1461,144 @@ void test_resize(char *filename)
 #endif
 }
 
+/*
+输入：同 load_image_stb_u8
+功能：与 load_image_stb_u8 相同，但图片无法解码(不是图片、文件不完整)时只打印原因，不退出
+返回：新分配的像素，失败时返回0
+*/
+static unsigned char *decode_image_stb_u8(char *filename, int channels, int *w, int *h, int *c)
+{
+    unsigned char *data = stbi_load(filename, w, h, c, channels);
+    if (!data) {
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
+        return 0;
+    }
+    if(channels) *c = channels;
+    int i, k;
+    int n = *w * *h;
+    unsigned char *planar = malloc((size_t)n * *c);
+    if(!planar) malloc_error();
+    for(k = 0; k < *c; ++k){
+        for(i = 0; i < n; ++i){
+            planar[(size_t)k*n + i] = data[(size_t)i * *c + k];
+        }
+    }
+    free(data);
+    return planar;
+}
+
+#ifdef LIBJPEG
+typedef struct{
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+} jpeg_error_jump;
+
+static void jpeg_error_jump_exit(j_common_ptr cinfo)
+{
+    longjmp(((jpeg_error_jump *)cinfo->err)->jump, 1);
+}
+
+/*
+输入：图片路径 filename，通道数 channels(0、1或3)，网络输入大小 w,h(为0时按原图大小解码)
+功能：用 libjpeg(libjpeg-turbo) 解码 JPEG 图片。w,h 不为0时在 1/8、1/4、1/2 中选最小的 DCT 缩放比例，
+     使解码出的图片仍不小于 letterbox 到 w x h 时缩放后的大小，大图只需要做一部分反 DCT
+输出：解码后的大小 *iw,*ih,*ic，原图的大小 *full_w,*full_h
+返回：按 c*h*w 排列的像素；不是 JPEG 或者解码失败时返回0，由调用者改用 stb 解码
+*/
+static unsigned char *load_image_jpeg_u8(char *filename, int channels, int w, int h, int *iw, int *ih, int *ic, int *full_w, int *full_h)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    unsigned char magic[2] = {0};
+    if(fread(magic, 1, 2, fp) != 2 || magic[0] != 0xFF || magic[1] != 0xD8){
+        fclose(fp);
+        return 0;
+    }
+    rewind(fp);
+
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_jump err;
+    unsigned char * volatile planar = 0;
+    unsigned char * volatile row = 0;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_error_jump_exit;
+    if(setjmp(err.jump)){
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
+        free(planar);
+        free(row);
+        return 0;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    if(cinfo.num_components != 1 && cinfo.num_components != 3) longjmp(err.jump, 1);  // CMYK 等交给 stb
+    int c = channels ? channels : cinfo.num_components;
+    if(c != 1 && c != 3) longjmp(err.jump, 1);
+    cinfo.out_color_space = (c == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    *full_w = cinfo.image_width;
+    *full_h = cinfo.image_height;
+
+    if(w > 0 && h > 0){
+        // 与 letterbox_image 相同的缩放后大小
+        int new_w, new_h;
+        if(((float)w/cinfo.image_width) < ((float)h/cinfo.image_height)){
+            new_w = w;
+            new_h = (cinfo.image_height * w)/cinfo.image_width;
+        } else {
+            new_h = h;
+            new_w = (cinfo.image_width * h)/cinfo.image_height;
+        }
+        int denom;
+        for(denom = 8; denom > 1; denom /= 2){
+            cinfo.scale_num = 1;
+            cinfo.scale_denom = denom;
+            jpeg_calc_output_dimensions(&cinfo);
+            if(cinfo.output_width >= new_w && cinfo.output_height >= new_h) break;
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    int ow = cinfo.output_width;
+    int oh = cinfo.output_height;
+    size_t n = (size_t)ow*oh;
+    planar = malloc(n*c);
+    row = malloc((size_t)ow*c);
+    if(!planar || !row) malloc_error();
+    while(cinfo.output_scanline < cinfo.output_height){
+        int y = cinfo.output_scanline;
+        JSAMPROW rows[1] = {row};
+        jpeg_read_scanlines(&cinfo, rows, 1);
+        int x, k;
+        for(k = 0; k < c; ++k){
+            unsigned char *dst = planar + k*n + (size_t)y*ow;
+            for(x = 0; x < ow; ++x) dst[x] = row[x*c + k];
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    free(row);
+    *iw = ow;
+    *ih = oh;
+    *ic = c;
+    return planar;
+}
+#endif
+
+/*
+输入：图片文件名 filename，通道数 channels(为0时使用图片本身的通道数)
+功能：用 stb 解码图片，像素保持 uint8，并从 stb 的 h x w x c 交错存放转换成与 image 相同的 c x h x w 存放
+返回：新分配的像素，大小写入 *w, *h, *c
+*/
+unsigned char *load_image_stb_u8(char *filename, int channels, int *w, int *h, int *c)
+{
+    unsigned char *planar = decode_image_stb_u8(filename, channels, w, h, c);
+    if(!planar) exit(0);
+    return planar;
+}
 
 image load_image_stb(char *filename, int channels)
 {
@@ -1340,6 +1645,191 @@ image load_image_color(char *filename, int w, int h)
     return load_image(filename, w, h, 3);
 }
 
+image_u8 make_image_u8(int w, int h, int c)
+{
+    image_u8 out;
+    out.w = w;
+    out.h = h;
+    out.c = c;
+    out.data = calloc((size_t)w*h*c, sizeof(unsigned char));
+    if(!out.data) malloc_error();
+    return out;
+}
+
+void free_image_u8(image_u8 m)
+{
+    if(m.data){
+        free(m.data);
+    }
+}
+
+// 插值结果四舍五入并限制到 [0,255]
+static inline unsigned char round_u8(float val)
+{
+    if(val <= 0) return 0;
+    if(val >= 255) return 255;
+    return (unsigned char)(val + .5f);
+}
+
+/*
+输入：图片路径 filename，w,h 不为0时缩放到 w x h，通道数 c(为0时使用图片本身的通道数)
+功能：与 load_image 相同，但像素保持为 uint8，不转换成 float
+返回：新分配的 image_u8
+*/
+image_u8 load_image_u8(char *filename, int w, int h, int c)
+{
+    image_u8 out;
+    out.data = load_image_stb_u8(filename, c, &out.w, &out.h, &out.c);
+    if((h && w) && (h != out.h || w != out.w)){
+        image_u8 resized = resize_image_u8(out, w, h);
+        free_image_u8(out);
+        out = resized;
+    }
+    return out;
+}
+
+/*
+输入：图片路径 filename，之后要 letterbox 到的大小 w,h，通道数 c
+功能：读取用于 letterbox 推理输入的图片，不缩放到 w x h。用 libjpeg 编译(LIBJPEG=1)时 JPEG 图片按不小于
+     letterbox 结果的最小 DCT 比例(1/2、1/4、1/8)解码，其他情况与 load_image_u8 相同
+输出：原图的大小 *full_w,*full_h(可以为0)，检测框需要换算到原图坐标时使用
+返回：新分配的 image_u8，可能比原图小
+*/
+image_u8 load_image_u8_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h)
+{
+    image_u8 out = try_load_image_u8_reduced(filename, w, h, c, full_w, full_h);
+    if(!out.data) exit(0);
+    return out;
+}
+
+/*
+功能：与 load_image_u8_reduced 相同，但图片无法解码时不退出，返回 data 为0、大小为0的空图像。
+     用于不能因为一个坏文件而退出的场合(例如检测服务)
+*/
+image_u8 try_load_image_u8_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h)
+{
+    image_u8 out = {0};
+#ifdef LIBJPEG
+    int fw, fh;
+    out.data = load_image_jpeg_u8(filename, c, w, h, &out.w, &out.h, &out.c, &fw, &fh);
+    if(out.data){
+        if(full_w) *full_w = fw;
+        if(full_h) *full_h = fh;
+        return out;
+    }
+#endif
+    out.data = decode_image_stb_u8(filename, c, &out.w, &out.h, &out.c);
+    if(!out.data) out.w = out.h = out.c = 0;
+    if(full_w) *full_w = out.w;
+    if(full_h) *full_h = out.h;
+    return out;
+}
+
+/*
+功能：与 load_image_u8_reduced 相同，返回 float 图像
+*/
+image load_image_reduced(char *filename, int w, int h, int c, int *full_w, int *full_h)
+{
+    image_u8 src = load_image_u8_reduced(filename, w, h, c, full_w, full_h);
+    image out = make_image(src.w, src.h, src.c);
+    image_u8_to_float(src, out.data);
+    free_image_u8(src);
+    return out;
+}
+
+/*
+输入：uint8 图像 im，目标大小 w,h
+功能：与 resize_image 相同的双线性缩放(两端像素对齐)。每个输出像素由上下两行、左右两列插值得到，
+     中间结果保留为 float，只在写出时取整一次
+返回：新分配的 image_u8
+*/
+image_u8 resize_image_u8(image_u8 im, int w, int h)
+{
+    image_u8 resized = make_image_u8(w, h, im.c);
+    float w_scale = (float)(im.w - 1) / (w - 1);
+    float h_scale = (float)(im.h - 1) / (h - 1);
+    int *ix = calloc(w, sizeof(int));
+    float *fx = calloc(w, sizeof(float));
+    int r, c, k;
+    for(c = 0; c < w; ++c){
+        if(c == w-1 || im.w == 1){
+            ix[c] = im.w-1;
+            fx[c] = 0;
+        } else {
+            float sx = c*w_scale;
+            ix[c] = (int) sx;
+            fx[c] = sx - ix[c];
+        }
+    }
+    for(k = 0; k < im.c; ++k){
+        for(r = 0; r < h; ++r){
+            int iy = im.h-1;
+            float dy = 0;
+            if(r != h-1 && im.h != 1){
+                float sy = r*h_scale;
+                iy = (int) sy;
+                dy = sy - iy;
+            }
+            unsigned char *row0 = im.data + ((size_t)k*im.h + iy)*im.w;
+            unsigned char *row1 = (dy > 0) ? row0 + im.w : row0;
+            unsigned char *out = resized.data + ((size_t)k*h + r)*w;
+            for(c = 0; c < w; ++c){
+                int i = ix[c];
+                int i1 = (fx[c] > 0) ? i + 1 : i;
+                float dx = fx[c];
+                float top = (1 - dx) * row0[i] + dx * row0[i1];
+                float bot = (1 - dx) * row1[i] + dx * row1[i1];
+                out[c] = round_u8((1 - dy) * top + dy * bot);
+            }
+        }
+    }
+    free(fx);
+    free(ix);
+    return resized;
+}
+
+/*
+输入：uint8 图像 im，目标大小 w,h
+功能：与 letterbox_image 相同，保持宽高比缩放后放在中间，其余部分填充 128(uint8 中最接近 0.5 的值)
+返回：新分配的 image_u8
+*/
+image_u8 letterbox_image_u8(image_u8 im, int w, int h)
+{
+    int new_w = im.w;
+    int new_h = im.h;
+    if (((float)w/im.w) < ((float)h/im.h)) {
+        new_w = w;
+        new_h = (im.h * w)/im.w;
+    } else {
+        new_h = h;
+        new_w = (im.w * h)/im.h;
+    }
+    image_u8 resized = resize_image_u8(im, new_w, new_h);
+    image_u8 boxed = make_image_u8(w, h, im.c);
+    memset(boxed.data, 128, (size_t)w*h*im.c);
+    int dx = (w-new_w)/2;
+    int dy = (h-new_h)/2;
+    int y, k;
+    for(k = 0; k < im.c; ++k){
+        for(y = 0; y < new_h; ++y){
+            memcpy(boxed.data + ((size_t)k*h + y + dy)*w + dx, resized.data + ((size_t)k*new_h + y)*new_w, new_w);
+        }
+    }
+    free_image_u8(resized);
+    return boxed;
+}
+
+/*
+输入：uint8 图像 im，输出 dst(大小至少为 im.w*im.h*im.c)
+功能：把像素从 [0,255] 转换到 [0,1] 的 float 写入 dst，与 load_image 的转换相同，一般直接写到网络的输入中
+输出：dst
+*/
+void image_u8_to_float(image_u8 im, float *dst)
+{
+    size_t i, n = (size_t)im.w*im.h*im.c;
+    for(i = 0; i < n; ++i) dst[i] = im.data[i]/255.;
+}
+
 image get_image_layer(image m, int l)
 {
     image out = make_image(m.w, m.h, 1);
@@ -20,6 +20,7 @@ image load_image_cv(char *filename, int channels);
 int show_image_cv(image im, const char* name, int ms);
 #endif
 
+unsigned char *load_image_stb_u8(char *filename, int channels, int *w, int *h, int *c);
 float get_color(int c, int x, int max);
 void draw_box(image a, int x1, int y1, int x2, int y2, float r, float g, float b);
 void draw_bbox(image a, box bbox, int w, float r, float g, float b);
@@ -38,6 +39,7 @@ void place_image(image im, int w, int h, int dx, int dy, image canvas);
 void saturate_image(image im, float sat);
 void exposure_image(image im, float sat);
 void distort_image(image im, float hue, float sat, float val);
+void place_distort_image(image_u8 im, int w, int h, int dx, int dy, float hue, float sat, float val, int flip, image canvas);
 void saturate_exposure_image(image im, float sat, float exposure);
 void rgb_to_hsv(image im);
 void hsv_to_rgb(image im);
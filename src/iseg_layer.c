@@ -10,7 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-layer make_iseg_layer(int batch, int w, int h, int classes, int ids)
+layer make_iseg_layer(int batch, int w, int h, int classes, int ids, int inference)
 {
     layer l = {0};
     l.type = ISEG;
@@ -28,7 +28,7 @@ layer make_iseg_layer(int batch, int w, int h, int classes, int ids)
     l.outputs = h*w*l.c;
     l.inputs = l.outputs;
     l.truths = 90*(l.w*l.h+1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(!inference) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
 
     l.counts = calloc(90, sizeof(int));
@@ -64,7 +64,7 @@ void resize_iseg_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -82,7 +82,6 @@ void forward_iseg_layer(const layer l, network net)
     int i,b,j,k;
     int ids = l.extra;
     memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
 
 #ifndef GPU
     for (b = 0; b < l.batch; ++b){
@@ -90,6 +89,8 @@ void forward_iseg_layer(const layer l, network net)
         activate_array(l.output + index, l.classes*l.w*l.h, LOGISTIC);
     }
 #endif
+    if(!net.truth) return;  // 推理时只计算输出
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
 
     for (b = 0; b < l.batch; ++b){
         // a priori, each pixel has no class
@@ -210,7 +211,7 @@ void forward_iseg_layer_gpu(const layer l, network net)
 
     cuda_pull_array(l.output_gpu, net.input, l.batch*l.inputs);
     forward_iseg_layer(l, net);
-    cuda_push_array(l.delta_gpu, l.delta, l.batch*l.outputs);
+    if(l.delta) cuda_push_array(l.delta_gpu, l.delta, l.batch*l.outputs);
 }
 
 void backward_iseg_layer_gpu(const layer l, network net)
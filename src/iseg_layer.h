@@ -5,7 +5,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_iseg_layer(int batch, int w, int h, int classes, int ids);
+layer make_iseg_layer(int batch, int w, int h, int classes, int ids, int inference);
 void forward_iseg_layer(const layer l, network net);
 void backward_iseg_layer(const layer l, network net);
 void resize_iseg_layer(layer *l, int w, int h);
@@ -9,7 +9,7 @@
 #include <stdio.h>
 #include <assert.h>
 
-layer make_l2norm_layer(int batch, int inputs)
+layer make_l2norm_layer(int batch, int inputs, int inference)
 {
     fprintf(stderr, "l2norm                                         %4d\n",  inputs);
     layer l = {0};
@@ -19,7 +19,7 @@ layer make_l2norm_layer(int batch, int inputs)
     l.outputs = inputs;
     l.output = calloc(inputs*batch, sizeof(float));
     l.scales = calloc(inputs*batch, sizeof(float));
-    l.delta = calloc(inputs*batch, sizeof(float));
+    if(!inference) l.delta = calloc(inputs*batch, sizeof(float));
 
     l.forward = forward_l2norm_layer;
     l.backward = backward_l2norm_layer;
@@ -0,0 +1,245 @@
+#include "label_set.h"
+#include "shard.h"
+#include "data.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+检测训练的标签集合：
+    训练开始时把列表中每张图片的标签一次读入内存，所有图片的标签框连续存放，按偏移表取出，
+    训练时不再对每个样本做路径替换、打开和解析标签文本。
+    也可以用 darknet dataset labels 预先把标签写成二进制索引文件(默认为训练列表加 .labels 后缀)，
+    在 .data 中用 label_index= 指定之后启动时直接读入。训练列表改变之后索引自动失效，重新读取标签文本；
+    索引不记录标签文本的内容，标签修改之后需要重新生成索引。
+*/
+
+static uint64_t label_paths_hash(char **paths, int n)
+{
+    uint64_t h = 1469598103934665603ULL;
+    int i;
+    for(i = 0; i < n; ++i){
+        unsigned char *p = (unsigned char *)paths[i];
+        while(*p){
+            h ^= *p++;
+            h *= 1099511628211ULL;
+        }
+        h ^= '\n';
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned int label_string_hash(char *s)
+{
+    unsigned int h = 5381;
+    while(*s) h = h*33 + (unsigned char)*s++;
+    return h;
+}
+
+// 建立路径到序号的哈希表
+static void label_set_index(label_set *s)
+{
+    int i;
+    s->table_size = 16;
+    while(s->table_size < 2*s->n) s->table_size *= 2;
+    s->table = malloc(s->table_size*sizeof(int));
+    for(i = 0; i < s->table_size; ++i) s->table[i] = -1;
+    for(i = 0; i < s->n; ++i){
+        int j = label_string_hash(s->paths[i]) & (s->table_size - 1);
+        while(s->table[j] >= 0) j = (j + 1) & (s->table_size - 1);
+        s->table[j] = i;
+    }
+}
+
+static label_set *read_label_set_text(char **paths, int n)
+{
+    label_set *s = calloc(1, sizeof(label_set));
+    s->n = n;
+    s->paths = paths;
+    s->offsets = calloc(n + 1, sizeof(int));
+    int size = 1024;
+    int total = 0;
+    s->boxes = calloc(size, sizeof(box_label));
+    int i;
+    for(i = 0; i < n; ++i){
+        char labelpath[4096];
+        detection_label_path(paths[i], labelpath);
+        int count = 0;
+        box_label *boxes = read_boxes(labelpath, &count);
+        if(total + count > size){
+            while(total + count > size) size *= 2;
+            s->boxes = realloc(s->boxes, size*sizeof(box_label));
+        }
+        memcpy(s->boxes + total, boxes, count*sizeof(box_label));
+        free(boxes);
+        total += count;
+        s->offsets[i+1] = total;
+        if((i + 1) % 10000 == 0) fprintf(stderr, "Read labels: %d/%d\n", i + 1, n);
+    }
+    return s;
+}
+
+/*
+输入：索引文件中的偏移表 offsets(n+1 个)，标签框总数 nboxes
+功能：检查偏移表从0开始、单调不减并且以 nboxes 结束，否则 label_set_boxes 会读到 boxes 之外
+返回：合法返回1，否则返回0
+*/
+static int valid_label_offsets(int *offsets, int n, uint64_t nboxes)
+{
+    int i;
+    if(nboxes > INT_MAX || offsets[0] != 0 || offsets[n] != (int)nboxes) return 0;
+    for(i = 0; i < n; ++i){
+        if(offsets[i+1] < offsets[i]) return 0;
+    }
+    return 1;
+}
+
+static label_set *read_label_set_file(char *filename, char **paths, int n)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    label_set_header h;
+    if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, LABEL_SET_MAGIC, 8) || h.version != LABEL_SET_VERSION ||
+            h.count != n || h.paths_hash != label_paths_hash(paths, n)){
+        fprintf(stderr, "Label index %s does not match the training list, reading label files\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    // 分配内存之前先确认 nboxes 与文件大小一致，损坏的文件头不能导致很大的分配
+    long size = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+    if(h.nboxes > INT_MAX || size < 0 ||
+            (uint64_t)size != sizeof(h) + (uint64_t)(n + 1)*sizeof(int) + h.nboxes*sizeof(shard_box) ||
+            fseek(fp, sizeof(h), SEEK_SET) != 0){
+        fprintf(stderr, "Label index %s is truncated or corrupt, reading label files\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    label_set *s = calloc(1, sizeof(label_set));
+    s->n = n;
+    s->paths = paths;
+    s->offsets = calloc(n + 1, sizeof(int));
+    s->boxes = calloc(h.nboxes ? h.nboxes : 1, sizeof(box_label));
+    shard_box *records = calloc(h.nboxes ? h.nboxes : 1, sizeof(shard_box));
+    if(!s->offsets || !s->boxes || !records){
+        fprintf(stderr, "Couldn't allocate label index %s, reading label files\n", filename);
+        fclose(fp);
+        free(records);
+        free_label_set(s);
+        return 0;
+    }
+    if(fread(s->offsets, sizeof(int), n + 1, fp) != n + 1 || fread(records, sizeof(shard_box), h.nboxes, fp) != h.nboxes ||
+            !valid_label_offsets(s->offsets, n, h.nboxes)){
+        fprintf(stderr, "Label index %s is truncated or corrupt, reading label files\n", filename);
+        fclose(fp);
+        free(records);
+        free_label_set(s);
+        return 0;
+    }
+    fclose(fp);
+    size_t i;
+    for(i = 0; i < h.nboxes; ++i){
+        box_label *b = s->boxes + i;
+        b->id = records[i].id;
+        b->x = records[i].x;
+        b->y = records[i].y;
+        b->w = records[i].w;
+        b->h = records[i].h;
+        b->left   = b->x - b->w/2;
+        b->right  = b->x + b->w/2;
+        b->top    = b->y - b->h/2;
+        b->bottom = b->y + b->h/2;
+    }
+    free(records);
+    return s;
+}
+
+/*
+输入：图片路径 paths(需要在标签集合释放之前一直有效)，个数 n，索引文件 index_file(可以为0)
+功能：读入所有图片的标签。index_file 存在并且与 paths 一致时从索引文件读取，否则逐个读取 labels 目录下的标签文本
+返回：标签集合，用 free_label_set 释放
+*/
+label_set *load_label_set(char **paths, int n, char *index_file)
+{
+    double start = what_time_is_it_now();
+    label_set *s = index_file ? read_label_set_file(index_file, paths, n) : 0;
+    if(!s) s = read_label_set_text(paths, n);
+    label_set_index(s);
+    fprintf(stderr, "Loaded labels for %d images, %d boxes in %f seconds\n", n, s->offsets[n], what_time_is_it_now() - start);
+    return s;
+}
+
+/*
+输入：标签集合 s，索引文件名 filename
+功能：把标签集合写成二进制索引文件，之后的训练可以用 load_label_set 直接读入
+*/
+void save_label_set(label_set *s, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    label_set_header h = {{0}};
+    memcpy(h.magic, LABEL_SET_MAGIC, 8);
+    h.version = LABEL_SET_VERSION;
+    h.count = s->n;
+    h.paths_hash = label_paths_hash(s->paths, s->n);
+    h.nboxes = s->offsets[s->n];
+    shard_box *records = calloc(h.nboxes ? h.nboxes : 1, sizeof(shard_box));
+    size_t i;
+    for(i = 0; i < h.nboxes; ++i){
+        records[i].x = s->boxes[i].x;
+        records[i].y = s->boxes[i].y;
+        records[i].w = s->boxes[i].w;
+        records[i].h = s->boxes[i].h;
+        records[i].id = s->boxes[i].id;
+    }
+    if(fwrite(&h, sizeof(h), 1, fp) != 1 ||
+            fwrite(s->offsets, sizeof(int), s->n + 1, fp) != s->n + 1 ||
+            fwrite(records, sizeof(shard_box), h.nboxes, fp) != h.nboxes){
+        file_error(filename);
+    }
+    fclose(fp);
+    free(records);
+    fprintf(stderr, "Wrote %s: %d images, %d boxes\n", filename, s->n, s->offsets[s->n]);
+}
+
+void free_label_set(label_set *s)
+{
+    if(!s) return;
+    free(s->offsets);
+    free(s->boxes);
+    free(s->table);
+    free(s);
+}
+
+/*
+输入：标签集合 s，图片路径 path
+功能：查找图片在标签集合中的序号，先比较指针(路径一般直接来自创建标签集合时的数组)，再比较字符串
+返回：序号，没有时返回-1
+*/
+int label_set_find(label_set *s, char *path)
+{
+    int j = label_string_hash(path) & (s->table_size - 1);
+    while(s->table[j] >= 0){
+        char *p = s->paths[s->table[j]];
+        if(p == path || !strcmp(p, path)) return s->table[j];
+        j = (j + 1) & (s->table_size - 1);
+    }
+    return -1;
+}
+
+/*
+输入：标签集合 s，图片序号 i
+功能：取出第 i 张图片的标签框，与 read_boxes 读取标签文件的结果相同
+返回：新分配的标签框数组(调用者可以修改)，个数写入 *n
+*/
+box_label *label_set_boxes(label_set *s, int i, int *n)
+{
+    int count = s->offsets[i+1] - s->offsets[i];
+    box_label *boxes = calloc(count ? count : 1, sizeof(box_label));
+    memcpy(boxes, s->boxes + s->offsets[i], count*sizeof(box_label));
+    *n = count;
+    return boxes;
+}
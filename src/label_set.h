@@ -0,0 +1,32 @@
+#ifndef LABEL_SET_H
+#define LABEL_SET_H
+
+#include "darknet.h"
+
+#include <stdint.h>
+
+#define LABEL_SET_MAGIC "DNLABEL1"
+#define LABEL_SET_VERSION 1
+
+// 标签索引文件的文件头，之后是 count+1 个 int32 的偏移和 nboxes 个 shard_box
+typedef struct{
+    char magic[8];
+    int32_t version;
+    int32_t count;          // 图片个数
+    uint64_t paths_hash;    // 所有图片路径的哈希，训练列表改变之后索引失效
+    uint64_t nboxes;        // 标签框总数
+} label_set_header;
+
+struct label_set{
+    int n;                  // 图片个数
+    char **paths;           // 图片路径，由调用者持有
+    int *offsets;           // 第 i 张图片的标签框为 boxes[offsets[i]] 到 boxes[offsets[i+1]-1]
+    box_label *boxes;
+    int *table;             // 路径到序号的哈希表(开放寻址)，-1 表示空位
+    int table_size;
+};
+
+box_label *label_set_boxes(label_set *s, int i, int *n);
+int label_set_find(label_set *s, char *path);
+
+#endif
@@ -32,6 +32,7 @@ void free_layer(layer l)
     if(l.scales)             free(l.scales);
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
+    if(l.winograd_weights)   free(l.winograd_weights);
     if(l.weight_updates)     free(l.weight_updates);
     if(l.delta)              free(l.delta);
     if(l.output)             free(l.output);
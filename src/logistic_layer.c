@@ -9,7 +9,7 @@
 #include <stdio.h>
 #include <assert.h>
 
-layer make_logistic_layer(int batch, int inputs)
+layer make_logistic_layer(int batch, int inputs, int inference)
 {
     fprintf(stderr, "logistic x entropy                             %4d\n",  inputs);
     layer l = {0};
@@ -19,7 +19,7 @@ layer make_logistic_layer(int batch, int inputs)
     l.outputs = inputs;
     l.loss = calloc(inputs*batch, sizeof(float));
     l.output = calloc(inputs*batch, sizeof(float));
-    l.delta = calloc(inputs*batch, sizeof(float));
+    if(!inference) l.delta = calloc(inputs*batch, sizeof(float));
     l.cost = calloc(1, sizeof(float));
 
     l.forward = forward_logistic_layer;
@@ -18,7 +18,7 @@ image get_maxpool_delta(maxpool_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
-maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding)
+maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding, int inference)
 {
     maxpool_layer l = {0};
     l.type = MAXPOOL;
@@ -37,7 +37,7 @@ maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int s
     int output_size = l.out_h * l.out_w * l.out_c * batch;
     l.indexes = calloc(output_size, sizeof(int));
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if(!inference) l.delta = calloc(output_size, sizeof(float));
     l.forward = forward_maxpool_layer;
     l.backward = backward_maxpool_layer;
     #ifdef GPU
@@ -64,7 +64,7 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
 
     l->indexes = realloc(l->indexes, output_size * sizeof(int));
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, output_size * sizeof(float));
 
     #ifdef GPU
     cuda_free((float *)l->indexes_gpu);
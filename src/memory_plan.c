@@ -0,0 +1,236 @@
+#include "memory_plan.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+前向推理时的激活内存规划：
+    每层的输出 l.output 在被最后一个使用它的层读完之后就不再需要，
+    根据层的顺序以及 route(input_layers)、shortcut(index) 的引用关系计算每个输出的生存期 [first, last]，
+    生存期不重叠的输出可以放在同一块内存上，所有输出统一分配在一块 net->arena 中。
+    检测、损失等层的输出在前向计算之后还要被读取(例如 get_network_boxes)，一直保留到最后。
+规划之后中间层的输出会被后面的层覆盖，所以只能用于推理，不能再做反向传播。
+*/
+
+// 按16个float(64字节)对齐，便于向量化
+#define PLAN_ALIGN 16
+
+typedef struct{
+    int index;      // 层的序号
+    int first;      // 输出第一次写入(即该层前向计算)的时刻
+    int last;       // 输出最后一次被读取的时刻
+    size_t size;    // 输出的大小(float个数，已对齐)
+    size_t offset;  // 在 arena 中的偏移
+} plan_block;
+
+/*
+输入：层类型 type
+功能：判断该类型的层的输出能否放到共享内存中：前向计算时会完整写入输出、不依赖上一次前向的结果，
+     也不会在前向计算中移动 l.output 指针(rnn、lstm等带状态的层不满足)
+返回：可以返回1，否则返回0
+*/
+static int plannable_layer(LAYER_TYPE type)
+{
+    switch(type){
+        case CONVOLUTIONAL:
+        case CONNECTED:
+        case MAXPOOL:
+        case AVGPOOL:
+        case ROUTE:
+        case SHORTCUT:
+        case UPSAMPLE:
+        case REORG:
+        case BATCHNORM:
+        case ACTIVE:
+        case L2NORM:
+        case LOGXENT:
+        case NORMALIZATION:
+        case CROP:
+        case SOFTMAX:
+        case YOLO:
+        case REGION:
+        case DETECTION:
+        case ISEG:
+        case COST:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+输入：层类型 type
+功能：判断该层的输出在前向计算结束之后是否还会被读取
+*/
+static int output_layer(LAYER_TYPE type)
+{
+    return type == YOLO || type == REGION || type == DETECTION || type == ISEG ||
+        type == COST || type == LOGXENT || type == SOFTMAX;
+}
+
+static int plan_block_size_comparator(const void *a, const void *b)
+{
+    const plan_block *pa = a;
+    const plan_block *pb = b;
+    if(pa->size != pb->size) return (pa->size < pb->size) ? 1 : -1;
+    return pa->index - pb->index;
+}
+
+static int plan_block_offset_comparator(const void *a, const void *b)
+{
+    const plan_block *pa = *(plan_block * const *)a;
+    const plan_block *pb = *(plan_block * const *)b;
+    if(pa->offset != pb->offset) return (pa->offset < pb->offset) ? -1 : 1;
+    return 0;
+}
+
+/*
+输入：网络 net
+功能：dropout 层的输出直接使用上一层的输出，找到第 i 层的输出实际属于哪一层
+返回：输出所属层的序号
+*/
+static int plan_owner(network *net, int i)
+{
+    while(i > 0 && net->layers[i].type == DROPOUT) --i;
+    return i;
+}
+
+static void plan_use(network *net, int *last, int index, int t)
+{
+    if(index < 0 || index >= net->n) return;
+    index = plan_owner(net, index);
+    if(t > last[index]) last[index] = t;
+}
+
+/*
+输入：网络 net
+功能：计算每层输出的生存期，按大小从大到小依次放到 arena 中与其生存期重叠的输出都不冲突的最低偏移处(greedy by size)，
+     然后把各层的 l.output 指向 arena 中对应的位置，并释放原来各层单独分配的输出。
+     重复调用没有副作用；GPU模式下不做规划
+输出：net->arena，各层的 l.output，net->output
+*/
+void plan_network_memory(network *net)
+{
+    int i, j;
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    if(net->arena) return;
+
+    int *last = calloc(net->n, sizeof(int));
+    int out_index = net->n - 1;
+    while(out_index > 0 && net->layers[out_index].type == COST) --out_index;
+    out_index = plan_owner(net, out_index);
+
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        last[i] = i;
+        if(i > 0) plan_use(net, last, i-1, i);  // 每层都以上一层的输出作为输入
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) plan_use(net, last, l.input_layers[j], i);
+        }
+        if(l.type == SHORTCUT) plan_use(net, last, l.index, i);
+    }
+    for(i = 0; i < net->n; ++i){
+        if(output_layer(net->layers[i].type) || i == out_index) last[plan_owner(net, i)] = net->n;
+    }
+
+    plan_block *blocks = calloc(net->n, sizeof(plan_block));
+    int nblocks = 0;
+    size_t before = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!plannable_layer(l.type) || !l.output || l.outputs <= 0) continue;
+        plan_block b = {0};
+        b.index = i;
+        b.first = i;
+        b.last = last[i];
+        b.size = ((size_t)l.outputs*l.batch + PLAN_ALIGN - 1)/PLAN_ALIGN*PLAN_ALIGN;
+        blocks[nblocks++] = b;
+        before += b.size;
+    }
+    qsort(blocks, nblocks, sizeof(plan_block), plan_block_size_comparator);
+
+    // 已经放好的块，按偏移排序
+    plan_block **placed = calloc(nblocks, sizeof(plan_block *));
+    int nplaced = 0;
+    size_t total = 0;
+    for(i = 0; i < nblocks; ++i){
+        plan_block *b = blocks + i;
+        size_t offset = 0;
+        for(j = 0; j < nplaced; ++j){
+            plan_block *p = placed[j];
+            if(p->last < b->first || b->last < p->first) continue;  // 生存期不重叠
+            if(p->offset >= offset + b->size) break;                // 找到足够大的空隙
+            if(p->offset + p->size > offset) offset = p->offset + p->size;
+        }
+        b->offset = offset;
+        if(offset + b->size > total) total = offset + b->size;
+        placed[nplaced++] = b;
+        qsort(placed, nplaced, sizeof(plan_block *), plan_block_offset_comparator);
+    }
+
+    if(nblocks){
+        net->arena = calloc(total, sizeof(float));
+        if(!net->arena) malloc_error();
+        for(i = 0; i < nblocks; ++i){
+            layer *l = net->layers + blocks[i].index;
+            free(l->output);
+            l->output = net->arena + blocks[i].offset;
+        }
+        for(i = 0; i < net->n; ++i){
+            if(net->layers[i].type == DROPOUT) net->layers[i].output = net->layers[plan_owner(net, i)].output;
+        }
+        net->output = net->layers[out_index].output;
+        fprintf(stderr, "Activation memory planned: %.1f MB -> %.1f MB\n",
+                before*sizeof(float)/1048576., total*sizeof(float)/1048576.);
+    }
+    free(placed);
+    free(blocks);
+    free(last);
+}
+
+/*
+输入：网络 net
+功能：释放 arena，指向其中的各层输出置为0，之后 free_layer 不会再释放它们。只用于 free_network 之前
+输出：各层的 l.output，net->output
+*/
+void release_network_memory(network *net)
+{
+    int i;
+    if(!net->arena) return;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        // 与 plan_network_memory 中放入 arena 的条件相同
+        if(plannable_layer(l->type) && l->output && l->outputs > 0) l->output = 0;
+    }
+    net->output = 0;
+    free(net->arena);
+    net->arena = 0;
+}
+
+/*
+输入：网络 net
+功能：撤销 plan_network_memory，各层重新单独分配输出并释放 arena，用于 resize_network 之前
+输出：各层的 l.output，net->output
+*/
+void unplan_network_memory(network *net)
+{
+    int i;
+    if(!net->arena) return;
+    float *arena = net->arena;
+    net->arena = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        // 与 plan_network_memory 中放入 arena 的条件相同
+        if(plannable_layer(l->type) && l->output && l->outputs > 0){
+            l->output = calloc((size_t)l->outputs*l->batch, sizeof(float));
+        }
+    }
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == DROPOUT) net->layers[i].output = net->layers[plan_owner(net, i)].output;
+    }
+    net->output = get_network_output_layer(net).output;
+    free(arena);
+}
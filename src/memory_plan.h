@@ -0,0 +1,10 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include "darknet.h"
+
+void plan_network_memory(network *net);
+void unplan_network_memory(network *net);
+void release_network_memory(network *net);
+
+#endif
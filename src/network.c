@@ -14,6 +14,7 @@
 #include "crnn_layer.h"
 #include "local_layer.h"
 #include "convolutional_layer.h"
+#include "memory_plan.h"
 #include "activation_layer.h"
 #include "detection_layer.h"
 #include "region_layer.h"
@@ -65,6 +66,30 @@ network *load_network(char *cfg, char *weights, int clear)
     return net;
 }
 
+/*
+输入：网络参数配置文件和权重文件的路径
+功能：以推理模式加载网络，各层不分配反向传播和更新权重用的内存(见 parse_network_cfg_inference)，
+     权重用 load_weights_mapped 映射加载，加载权重后把所有卷积层的 batchnorm 折叠进卷积计算(见 fuse_batchnorm_convolutional_layer)，
+     前向计算时不再单独做 normalize、scale_bias、add_bias 等多次遍历，映射中的权重也不会被修改；
+     并用 plan_network_memory 让生存期不重叠的层输出共用内存。返回的网络只能用于推理
+返回值：网络参数(含超参数)
+*/
+network *load_network_inference(char *cfg, char *weights)
+{
+    int i;
+    network *net = parse_network_cfg_inference(cfg);
+    if(weights && weights[0] != 0){
+        load_weights_mapped(net, weights);
+    }
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == CONVOLUTIONAL){
+            fuse_batchnorm_convolutional_layer(&net->layers[i]);
+        }
+    }
+    plan_network_memory(net);
+    return net;
+}
+
 size_t get_current_batch(network *net)
 {
     size_t batch_num = (*net->seen)/(net->batch*net->subdivisions);
@@ -317,6 +342,7 @@ void backward_network(network *netp)
 float train_network_datum(network *net)
 {
     // seen 表示已经训练了多少数据，每次训练都是batch个数据，这里的net.batch为子batch,不是配置文件里的batch,而是 net.batch(完整batch) / net.subdivision 
+    if(net->inference) error("Network was built for inference only and can not be trained");
     *net->seen += net->batch;        
     net->train = 1;
     forward_network(net);
@@ -347,13 +373,23 @@ float train_network(network *net, data d)
     int batch = net->batch;
     int n = d.X.rows / batch;
 
+    float *input = net->input;
+    float *truth = net->truth;
+    int view = d.X.cols == net->inputs && (!truth || d.y.cols == net->truths);
+
     int i;
     float sum = 0;
     for(i = 0; i < n; ++i){
-        get_next_batch(d, batch, i*batch, net->input, net->truth);
+        // 数据连续时网络直接使用 d 中的内存，训练完之后换回网络自己的输入、标签缓冲
+        net->input = input;
+        net->truth = truth;
+        if(view) get_next_batch_view(d, batch, i*batch, &net->input, &net->truth);
+        else get_next_batch(d, batch, i*batch, net->input, net->truth);
         float err = train_network_datum(net);
         sum += err;
     }
+    net->input = input;
+    net->truth = truth;
     return (float)sum/(n*batch);
 }
 
@@ -392,6 +428,9 @@ int resize_network(network *net, int w, int h)
     cuda_free(net->workspace);
 #endif
     int i;
+    // 各层的 resize 函数会 realloc 输出，先撤销内存规划，resize 之后再重新规划
+    int planned = net->arena != 0;
+    unplan_network_memory(net);
     //if(w == net->w && h == net->h) return 0;
     net->w = w;
     net->h = h;
@@ -463,6 +502,7 @@ int resize_network(network *net, int w, int h)
     free(net->workspace);
     net->workspace = calloc(1, workspace_size);
 #endif
+    if(planned) plan_network_memory(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -537,6 +577,133 @@ float *network_predict(network *net, float *input)
     return out;
 }
 
+/*
+输入：层 l
+功能：判断该层能否在多个执行上下文之间共享：前向计算(非训练)时除了 l.output、l.x、l.indexes 和 net.workspace 之外
+     不写入层内的任何内存。rnn、lstm 等带状态的层，以及二值化卷积(前向时写 l.binary_weights)不满足
+返回：可以共享返回1，否则返回0
+*/
+static int network_ctx_supported_layer(layer l)
+{
+    if(l.truth) return 0;  // 前向时会把该层的输出作为 net.truth，之后的 softmax 等层会写入 l.delta、l.loss
+    switch(l.type){
+        case CONVOLUTIONAL:
+            return !l.binary && !l.xnor;
+        case CONNECTED:
+        case MAXPOOL:
+        case AVGPOOL:
+        case ROUTE:
+        case SHORTCUT:
+        case UPSAMPLE:
+        case REORG:
+        case BATCHNORM:
+        case ACTIVE:
+        case LOGXENT:
+        case DROPOUT:
+        case CROP:
+        case SOFTMAX:
+        case COST:
+        case YOLO:
+        case REGION:
+        case DETECTION:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+输入：已经加载好权重的网络 net
+功能：为 net 创建一个执行上下文。上下文中的层数组是 net->layers 的浅拷贝，权重、偏置等只读的参数与 net 共享，
+     各层的输出、maxpool 的 l.indexes、工作空间和 cost 为上下文私有；net 做过 plan_network_memory 时上下文也做同样的规划。
+     一个 net 可以创建多个上下文，每个线程使用自己的上下文调用 network_predict_ctx，互不影响。
+     上下文的 batch 和输入大小与创建时的 net 相同，之后对 net 做 resize_network、set_batch_network 或释放 net 时需要先释放所有上下文
+返回：执行上下文，用 free_network_ctx 释放
+*/
+network_ctx *make_network_ctx(network *net)
+{
+    int i;
+#ifdef GPU
+    if(net->gpu_index >= 0) error("Network contexts are only supported on the CPU");
+#endif
+    network_ctx *ctx = calloc(1, sizeof(network_ctx));
+    ctx->base = net;
+    ctx->net = *net;
+    network *cn = &ctx->net;
+    cn->gpu_index = -1;
+    cn->train = 0;
+    cn->input = 0;
+    cn->truth = 0;
+    cn->delta = 0;
+    cn->arena = 0;
+    cn->dets = 0;
+    cn->ndets = 0;
+    cn->weights_map = 0;  // 权重属于 base
+    cn->weights_map_size = 0;
+    cn->cost = calloc(1, sizeof(float));
+    cn->layers = calloc(net->n, sizeof(layer));
+
+    size_t workspace_size = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!network_ctx_supported_layer(l)){
+            fprintf(stderr, "Layer %d (%s) can not be shared between network contexts\n", i, get_layer_string(l.type));
+            error("Unsupported layer for network_ctx");
+        }
+        // 训练用的内存在前向(非训练)时不需要，置0保证上下文不会写入共享的内存
+        l.delta = 0;
+        l.x = 0;
+        l.x_norm = 0;
+        if(l.type == DROPOUT){
+            l.output = cn->layers[i-1].output;
+        } else {
+            l.output = calloc((size_t)l.outputs*l.batch, sizeof(float));
+        }
+        if(l.type == MAXPOOL) l.indexes = calloc((size_t)l.outputs*l.batch, sizeof(int));
+        if(l.workspace_size > workspace_size) workspace_size = l.workspace_size;
+        cn->layers[i] = l;
+    }
+    cn->workspace = workspace_size ? calloc(1, workspace_size) : 0;
+    cn->output = get_network_output_layer(cn).output;
+    if(net->arena) plan_network_memory(cn);
+    return ctx;
+}
+
+/*
+输入：执行上下文 ctx
+功能：释放上下文私有的内存，共享的权重仍属于 ctx->base
+*/
+void free_network_ctx(network_ctx *ctx)
+{
+    int i;
+    network *cn = &ctx->net;
+    for(i = 0; i < cn->n; ++i){
+        layer l = cn->layers[i];
+        if(l.type == MAXPOOL) free(l.indexes);
+        if(!cn->arena && l.type != DROPOUT) free(l.output);
+    }
+    free(cn->arena);
+    for(i = 0; i < cn->ndets; ++i) free_detection_batch(cn->dets + i);
+    free(cn->dets);
+    free(cn->workspace);
+    free(cn->cost);
+    free(cn->layers);
+    free(ctx);
+}
+
+/*
+输入：执行上下文 ctx，输入数据 input
+功能：与 network_predict 相同，但只修改上下文中的数据，不修改共享的网络，可以在多个线程中分别用各自的上下文同时调用。
+     计算之后可以用 get_network_boxes(&ctx->net, ...) 等从上下文中取结果
+返回：网络的输出，位于上下文中，下一次调用时被覆盖
+*/
+float *network_predict_ctx(network_ctx *ctx, float *input)
+{
+    ctx->net.input = input;
+    forward_network(&ctx->net);
+    return ctx->net.output;
+}
+
 int num_detections(network *net, float thresh)
 {
     int i;
@@ -589,10 +756,245 @@ void fill_network_boxes(network *net, int w, int h, float thresh, float hier, in
     }
 }
 
+// 保证 b 中至少能放 n 个检测框，只按需要的个数增长，不会缩小
+static void detection_batch_reserve(detection_batch *b, int n, int classes, int coords)
+{
+    int m = coords > 4 ? coords - 4 : 0;
+    if(b->size && (b->classes != classes || b->coords != coords)){
+        free(b->boxes);
+        free(b->objectness);
+        free(b->prob);
+        free(b->mask);
+        free(b->dets);
+        b->boxes = 0;
+        b->objectness = 0;
+        b->prob = b->mask = 0;
+        b->dets = 0;
+        b->size = 0;
+    }
+    b->classes = classes;
+    b->coords = coords;
+    if(n <= b->size) return;
+    b->boxes = realloc(b->boxes, n*sizeof(box));
+    b->objectness = realloc(b->objectness, n*sizeof(float));
+    b->prob = realloc(b->prob, (size_t)n*classes*sizeof(float));
+    if(m) b->mask = realloc(b->mask, (size_t)n*m*sizeof(float));
+    b->dets = realloc(b->dets, n*sizeof(detection));
+    if(!b->boxes || !b->objectness || !b->prob || (m && !b->mask) || !b->dets) malloc_error();
+    b->size = n;
+}
+
+/*
+输入：检测结果 b，REGION 或 DETECTION 层 l 的结果从第 offset 个开始存放
+功能：旧的层按 detection 输出，用 b->dets 中对应的一段作为指向 b 中矩阵的视图接收结果，再把检测框和 objectness 取回。
+     b->dets 已经按检测框总数分配，每一帧重复使用，不再临时分配
+*/
+static void decode_legacy_boxes(network *net, layer l, int w, int h, float thresh, float hier, int *map, int relative, detection_batch *b, int offset)
+{
+    int i;
+    int count = l.w*l.h*l.n;
+    int m = b->coords > 4 ? b->coords - 4 : 0;
+    detection *dets = b->dets + offset;
+    memset(dets, 0, count*sizeof(detection));
+    for(i = 0; i < count; ++i){
+        dets[i].prob = b->prob + (size_t)(offset + i)*b->classes;
+        dets[i].mask = m ? b->mask + (size_t)(offset + i)*m : 0;
+    }
+    if(l.type == REGION) get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets);
+    else get_detection_detections(l, w, h, thresh, dets);
+    for(i = 0; i < count; ++i){
+        b->boxes[offset + i] = dets[i].bbox;
+        b->objectness[offset + i] = dets[i].objectness;
+    }
+}
+
+/*
+输入：检测层 l，图片在批中的序号 image
+功能：取出第 image 张图片的输出，作为 batch 为1的层(局部的拷贝，不修改网络，可以在多个线程中同时使用)。
+     image 小于0时保持原样：只读第0张，batch 为2时把两张当作原图和翻转图像取平均
+*/
+static layer image_layer(layer l, int image)
+{
+    if(image < 0) return l;
+    l.output += (size_t)image*l.outputs;
+    l.batch = 1;
+    return l;
+}
+
+/*
+输入：网络 net(已经完成前向计算)，图片在批中的序号 image(见 image_layer)，原图大小 w,h，
+     阈值 thresh、hier，类别映射 map，relative 同 get_network_boxes，检测结果 b
+功能：一遍完成检测结果的解码：先在每个YOLO层中只扫描一次 objectness 记下超过阈值的位置，
+     按总数一次准备好 b 的空间，再只对这些位置计算检测框和类别概率，直接写入 b 的各个数组
+返回：检测框个数 b->n
+*/
+static int decode_image_boxes(network *net, int image, int w, int h, float thresh, float hier, int *map, int relative, detection_batch *b)
+{
+    int i;
+    layer out = net->layers[net->n - 1];
+    int total = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == YOLO) total += l.w*l.h*l.n;
+    }
+    // 候选位置之后再放每层的候选个数
+    if(total + net->n > b->candidates_size){
+        free(b->candidates);
+        b->candidates = calloc(total + net->n, sizeof(int));
+        b->candidates_size = total + net->n;
+    }
+    int *counts = b->candidates + total;
+
+    // 第一步：找出各层的候选位置，REGION、DETECTION层每个位置都输出
+    int n = 0;
+    int *candidates = b->candidates;
+    for(i = 0; i < net->n; ++i){
+        layer l = image_layer(net->layers[i], image);
+        if(l.type == YOLO){
+            if(l.batch == 2) avg_flipped_yolo(l);
+            counts[i] = yolo_candidates(l, thresh, candidates);
+            candidates += l.w*l.h*l.n;
+            n += counts[i];
+        }
+        if(l.type == DETECTION || l.type == REGION){
+            n += l.w*l.h*l.n;
+        }
+    }
+    detection_batch_reserve(b, n, out.classes, out.coords);
+    b->n = n;
+
+    // 第二步：只解码候选位置
+    int offset = 0;
+    candidates = b->candidates;
+    for(i = 0; i < net->n; ++i){
+        layer l = image_layer(net->layers[i], image);
+        if(l.type == YOLO){
+            get_yolo_candidate_detections(l, candidates, counts[i], w, h, net->w, net->h, thresh, relative,
+                    b->boxes + offset, b->objectness + offset, b->prob + (size_t)offset*b->classes);
+            candidates += l.w*l.h*l.n;
+            offset += counts[i];
+        }
+        if(l.type == REGION || l.type == DETECTION){
+            decode_legacy_boxes(net, l, w, h, thresh, hier, map, relative, b, offset);
+            offset += l.w*l.h*l.n;
+        }
+    }
+    return n;
+}
+
+/*
+输入：网络 net(已经完成前向计算)，原图大小 w,h，其余参数同 get_network_boxes，
+     调用者持有的检测结果 b（第一次使用时清零即可，用 free_detection_batch 释放）
+功能：解码第0张图片的检测结果，batch 为2时把两张当作原图和翻转图像取平均
+返回：检测框个数 b->n，结果在下一次解码之前有效
+*/
+int decode_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection_batch *b)
+{
+    return decode_image_boxes(net, -1, w, h, thresh, hier, map, relative, b);
+}
+
+// 网络持有的检测结果，保证至少有 n 个
+static detection_batch *network_detection_batches(network *net, int n)
+{
+    if(n > net->ndets){
+        net->dets = realloc(net->dets, n*sizeof(detection_batch));
+        memset(net->dets + net->ndets, 0, (n - net->ndets)*sizeof(detection_batch));
+        net->ndets = n;
+    }
+    return net->dets;
+}
+
+/*
+输入：网络 net(已经完成前向计算)，参数同 get_network_boxes
+功能：解码到网络自己持有的检测结果中，第一次调用时分配，之后每一帧重复使用，随 free_network 释放。
+     结果属于网络，多个线程不能对同一个 network 同时调用(各自使用 make_network_ctx 的上下文，或者用 decode_network_boxes)
+返回：检测结果，属于网络，下一次调用时被覆盖
+*/
+detection_batch *get_network_detections(network *net, int w, int h, float thresh, float hier, int *map, int relative)
+{
+    detection_batch *dets = network_detection_batches(net, 1);
+    decode_network_boxes(net, w, h, thresh, hier, map, relative, dets);
+    return dets;
+}
+
+/*
+输入：网络 net(已经对一批图片完成前向计算)，图片张数 n(不超过 net->batch)，每张图片的原图大小 w[i],h[i]，
+     阈值 thresh、hier，类别映射 map，relative 同 get_network_boxes，nms 为NMS的阈值(为0时不做)
+功能：分别取出批中每张图片的检测结果并按类别做NMS，图片之间用 OpenMP 并行。
+     与 get_network_detections 不同，batch 为2时两张图片也是独立的，不会被当作翻转图像取平均
+返回：n 个检测结果，第 i 个属于第 i 张图片，属于网络，下一次调用时被覆盖
+*/
+detection_batch *get_network_detections_batch(network *net, int n, int *w, int *h, float thresh, float hier, int *map, int relative, float nms)
+{
+    int i;
+    if(n > net->batch) error("More images than the network batch");
+    detection_batch *dets = network_detection_batches(net, n);
+    #pragma omp parallel for
+    for(i = 0; i < n; ++i){
+        decode_image_boxes(net, i, w[i], h[i], thresh, hier, map, relative, dets + i);
+        if(nms) do_nms_sort_batch(dets + i, nms);
+    }
+    return dets;
+}
+
+/*
+输入：检测结果 b
+功能：填写 b->dets 视图，供使用 detection 的接口使用。视图中的 prob、mask 指向 b 中的矩阵，
+     对它们的修改(例如 do_nms_sort 把概率置0)会反映到 b 中；视图本身可以被重新排序，不影响 b 中的顺序
+返回：b->dets，共 b->n 个，不需要也不能用 free_detections 释放
+*/
+detection *detection_batch_dets(detection_batch *b)
+{
+    int i;
+    int m = b->coords > 4 ? b->coords - 4 : 0;
+    for(i = 0; i < b->n; ++i){
+        detection *d = b->dets + i;
+        d->bbox = b->boxes[i];
+        d->objectness = b->objectness[i];
+        d->classes = b->classes;
+        d->prob = b->prob + (size_t)i*b->classes;
+        d->mask = m ? b->mask + (size_t)i*m : 0;
+        d->sort_class = 0;
+    }
+    return b->dets;
+}
+
+void free_detection_batch(detection_batch *b)
+{
+    free(b->boxes);
+    free(b->objectness);
+    free(b->prob);
+    free(b->mask);
+    free(b->dets);
+    free(b->candidates);
+    memset(b, 0, sizeof(detection_batch));
+}
+
+/*
+输入：网络 net(已经完成前向计算)，原图大小 w,h，阈值 thresh、hier，类别映射 map，relative
+功能：旧的接口，解码到一个临时的检测结果中再逐个复制出来，不使用网络持有的 net->dets，
+     与之前一样可以在多个线程中对同一个网络(的不同上下文)同时调用
+返回：检测框数组，个数写入 *num，用 free_detections 释放
+*/
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num)
 {
-    detection *dets = make_network_boxes(net, thresh, num);
-    fill_network_boxes(net, w, h, thresh, hier, map, relative, dets);
+    int i;
+    detection_batch local = {0};
+    detection_batch *b = &local;
+    decode_network_boxes(net, w, h, thresh, hier, map, relative, b);
+    if(num) *num = b->n;
+    // 返回给调用者的结果每个检测框单独分配，用 free_detections 释放
+    detection *dets = calloc(b->n, sizeof(detection));
+    memcpy(dets, detection_batch_dets(b), b->n*sizeof(detection));
+    for(i = 0; i < b->n; ++i){
+        dets[i].prob = calloc(b->classes, sizeof(float));
+        memcpy(dets[i].prob, b->prob + (size_t)i*b->classes, b->classes*sizeof(float));
+        if(b->coords > 4){
+            dets[i].mask = calloc(b->coords-4, sizeof(float));
+            memcpy(dets[i].mask, b->mask + (size_t)i*(b->coords-4), (b->coords-4)*sizeof(float));
+        }
+    }
+    free_detection_batch(b);
     return dets;
 }
 
@@ -746,12 +1148,16 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    release_network_memory(net);
+    unmap_weights(net);
     for(i = 0; i < net->n; ++i){
         free_layer(net->layers[i]);
     }
     free(net->layers);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
+    for(i = 0; i < net->ndets; ++i) free_detection_batch(net->dets + i);
+    free(net->dets);
 #ifdef GPU
     if(net->input_gpu) cuda_free(net->input_gpu);
     if(net->truth_gpu) cuda_free(net->truth_gpu);
@@ -3,7 +3,7 @@
 
 #include <stdio.h>
 
-layer make_normalization_layer(int batch, int w, int h, int c, int size, float alpha, float beta, float kappa)
+layer make_normalization_layer(int batch, int w, int h, int c, int size, float alpha, float beta, float kappa, int inference)
 {
     fprintf(stderr, "Local Response Normalization Layer: %d x %d x %d image, %d size\n", w,h,c,size);
     layer layer = {0};
@@ -17,7 +17,7 @@ layer make_normalization_layer(int batch, int w, int h, int c, int size, float a
     layer.alpha = alpha;
     layer.beta = beta;
     layer.output = calloc(h * w * c * batch, sizeof(float));
-    layer.delta = calloc(h * w * c * batch, sizeof(float));
+    if(!inference) layer.delta = calloc(h * w * c * batch, sizeof(float));
     layer.squared = calloc(h * w * c * batch, sizeof(float));
     layer.norms = calloc(h * w * c * batch, sizeof(float));
     layer.inputs = w*h*c;
@@ -48,7 +48,7 @@ void resize_normalization_layer(layer *layer, int w, int h)
     layer->inputs = w*h*c;
     layer->outputs = layer->inputs;
     layer->output = realloc(layer->output, h * w * c * batch * sizeof(float));
-    layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
+    if(layer->delta) layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
     layer->squared = realloc(layer->squared, h * w * c * batch * sizeof(float));
     layer->norms = realloc(layer->norms, h * w * c * batch * sizeof(float));
 #ifdef GPU
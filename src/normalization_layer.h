@@ -5,7 +5,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_normalization_layer(int batch, int w, int h, int c, int size, float alpha, float beta, float kappa);
+layer make_normalization_layer(int batch, int w, int h, int c, int size, float alpha, float beta, float kappa, int inference);
 void resize_normalization_layer(layer *layer, int h, int w);
 void forward_normalization_layer(const layer layer, network net);
 void backward_normalization_layer(const layer layer, network net);
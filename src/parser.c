@@ -2,6 +2,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "activation_layer.h"
 #include "logistic_layer.h"
@@ -13,6 +17,7 @@
 #include "connected_layer.h"
 #include "deconvolutional_layer.h"
 #include "convolutional_layer.h"
+#include "winograd.h"
 #include "cost_layer.h"
 #include "crnn_layer.h"
 #include "crop_layer.h"
@@ -155,7 +160,7 @@ local_layer parse_local(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before local layer must output image.");
 
-    local_layer layer = make_local_layer(batch,h,w,c,n,size,stride,pad,activation);
+    local_layer layer = make_local_layer(batch,h,w,c,n,size,stride,pad,activation, params.net->inference);
 
     return layer;
 }
@@ -214,9 +219,15 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int binary = option_find_int_quiet(options, "binary", 0);
     int xnor = option_find_int_quiet(options, "xnor", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam, params.net->inference);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
+    // 是否使用隐式gemm，默认与[net]中的implicit一致
+    set_convolutional_implicit(&layer, option_find_int_quiet(options, "implicit", params.net->implicit));
+    // Winograd输出块大小，默认与[net]中的winograd一致，可以设置为2、4（乘法更少）或0（关闭）。
+    // 都没有设置时推理网络在解析完所有层之后自动选择，见 parse_network_cfg_mode
+    int winograd = option_find_int_quiet(options, "winograd", params.net->winograd);
+    set_convolutional_winograd(&layer, winograd < 0 ? 0 : winograd);
 
     return layer;
 }
@@ -282,14 +293,14 @@ layer parse_connected(list *options, size_params params)
     ACTIVATION activation = get_activation(activation_s);
     int batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
 
-    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam);
+    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam, params.net->inference);
     return l;
 }
 
 layer parse_softmax(list *options, size_params params)
 {
     int groups = option_find_int_quiet(options, "groups",1);
-    layer l = make_softmax_layer(params.batch, params.inputs, groups);
+    layer l = make_softmax_layer(params.batch, params.inputs, groups, params.net->inference);
     l.temperature = option_find_float_quiet(options, "temperature", 1);
     char *tree_file = option_find_str(options, "tree", 0);
     if (tree_file) l.softmax_tree = read_tree(tree_file);
@@ -330,7 +341,7 @@ layer parse_yolo(list *options, size_params params)
 
     char *a = option_find_str(options, "mask", 0);
     int *mask = parse_yolo_mask(a, &num);
-    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes);
+    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes, params.net->inference);
     assert(l.outputs == params.inputs);
 
     l.max_boxes = option_find_int_quiet(options, "max",90);
@@ -364,7 +375,7 @@ layer parse_iseg(list *options, size_params params)
 {
     int classes = option_find_int(options, "classes", 20);
     int ids = option_find_int(options, "ids", 32);
-    layer l = make_iseg_layer(params.batch, params.w, params.h, classes, ids);
+    layer l = make_iseg_layer(params.batch, params.w, params.h, classes, ids, params.net->inference);
     assert(l.outputs == params.inputs);
     return l;
 }
@@ -375,7 +386,7 @@ layer parse_region(list *options, size_params params)
     int classes = option_find_int(options, "classes", 20);
     int num = option_find_int(options, "num", 1);
 
-    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords);
+    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords, params.net->inference);
     assert(l.outputs == params.inputs);
 
     l.log = option_find_int_quiet(options, "log", 0);
@@ -428,7 +439,7 @@ detection_layer parse_detection(list *options, size_params params)
     int rescore = option_find_int(options, "rescore", 0);
     int num = option_find_int(options, "num", 1);
     int side = option_find_int(options, "side", 7);
-    detection_layer layer = make_detection_layer(params.batch, params.inputs, num, side, classes, coords, rescore);
+    detection_layer layer = make_detection_layer(params.batch, params.inputs, num, side, classes, coords, rescore, params.net->inference);
 
     layer.softmax = option_find_int(options, "softmax", 0);
     layer.sqrt = option_find_int(options, "sqrt", 0);
@@ -450,7 +461,7 @@ cost_layer parse_cost(list *options, size_params params)
     char *type_s = option_find_str(options, "type", "sse");
     COST_TYPE type = get_cost_type(type_s);
     float scale = option_find_float_quiet(options, "scale",1);
-    cost_layer layer = make_cost_layer(params.batch, params.inputs, type, scale);
+    cost_layer layer = make_cost_layer(params.batch, params.inputs, type, scale, params.net->inference);
     layer.ratio =  option_find_float_quiet(options, "ratio",0);
     layer.noobject_scale =  option_find_float_quiet(options, "noobj", 1);
     layer.thresh =  option_find_float_quiet(options, "thresh",0);
@@ -495,7 +506,7 @@ layer parse_reorg(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before reorg layer must output image.");
 
-    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse, flatten, extra);
+    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse, flatten, extra, params.net->inference);
     return layer;
 }
 
@@ -512,7 +523,7 @@ maxpool_layer parse_maxpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before maxpool layer must output image.");
 
-    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding);
+    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding, params.net->inference);
     return layer;
 }
 
@@ -525,14 +536,14 @@ avgpool_layer parse_avgpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before avgpool layer must output image.");
 
-    avgpool_layer layer = make_avgpool_layer(batch,w,h,c);
+    avgpool_layer layer = make_avgpool_layer(batch,w,h,c, params.net->inference);
     return layer;
 }
 
 dropout_layer parse_dropout(list *options, size_params params)
 {
     float probability = option_find_float(options, "probability", .5);
-    dropout_layer layer = make_dropout_layer(params.batch, params.inputs, probability);
+    dropout_layer layer = make_dropout_layer(params.batch, params.inputs, probability, params.net->inference);
     layer.out_w = params.w;
     layer.out_h = params.h;
     layer.out_c = params.c;
@@ -545,13 +556,13 @@ layer parse_normalization(list *options, size_params params)
     float beta =  option_find_float(options, "beta" , .75);
     float kappa = option_find_float(options, "kappa", 1);
     int size = option_find_int(options, "size", 5);
-    layer l = make_normalization_layer(params.batch, params.w, params.h, params.c, size, alpha, beta, kappa);
+    layer l = make_normalization_layer(params.batch, params.w, params.h, params.c, size, alpha, beta, kappa, params.net->inference);
     return l;
 }
 
 layer parse_batchnorm(list *options, size_params params)
 {
-    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c);
+    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c, params.net->inference);
     return l;
 }
 
@@ -564,7 +575,7 @@ layer parse_shortcut(list *options, size_params params, network *net)
     int batch = params.batch;
     layer from = net->layers[index];
 
-    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c);
+    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c, params.net->inference);
 
     char *activation_s = option_find_str(options, "activation", "linear");
     ACTIVATION activation = get_activation(activation_s);
@@ -577,7 +588,7 @@ layer parse_shortcut(list *options, size_params params, network *net)
 
 layer parse_l2norm(list *options, size_params params)
 {
-    layer l = make_l2norm_layer(params.batch, params.inputs);
+    layer l = make_l2norm_layer(params.batch, params.inputs, params.net->inference);
     l.h = l.out_h = params.h;
     l.w = l.out_w = params.w;
     l.c = l.out_c = params.c;
@@ -587,7 +598,7 @@ layer parse_l2norm(list *options, size_params params)
 
 layer parse_logistic(list *options, size_params params)
 {
-    layer l = make_logistic_layer(params.batch, params.inputs);
+    layer l = make_logistic_layer(params.batch, params.inputs, params.net->inference);
     l.h = l.out_h = params.h;
     l.w = l.out_w = params.w;
     l.c = l.out_c = params.c;
@@ -612,7 +623,7 @@ layer parse_upsample(list *options, size_params params, network *net)
 {
 
     int stride = option_find_int(options, "stride",2);
-    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride);
+    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride, params.net->inference);
     l.scale = option_find_float_quiet(options, "scale", 1);
     return l;
 }
@@ -639,7 +650,7 @@ route_layer parse_route(list *options, size_params params, network *net)
     }
     int batch = params.batch;
 
-    route_layer layer = make_route_layer(batch, n, layers, sizes);
+    route_layer layer = make_route_layer(batch, n, layers, sizes, params.net->inference);
 
     convolutional_layer first = net->layers[layers[0]];
     layer.out_w = first.out_w;
@@ -695,6 +706,11 @@ void parse_net_options(list *options, network *net)
     net->batch *= net->time_steps;  // 注意这个真实的batch求法
     net->subdivisions = subdivs;
     net->random = option_find_int_quiet(options, "random", 0);
+    net->implicit = option_find_int_quiet(options, "implicit", 0);
+    // 卷积层的Winograd：工作空间约为 (m+2)^2*(c+n)*块数，变换后的卷积核为原来的 (m+2)^2/9 倍。
+    // 不设置时为-1，训练网络不使用，推理网络自动选择(见 parse_convolutional)
+    net->winograd = option_find_int_quiet(options, "winograd", -1);
+    net->inference = option_find_int_quiet(options, "inference", 0);
 
     net->adam = option_find_int_quiet(options, "adam", 0);
     if(net->adam){
@@ -770,10 +786,12 @@ int is_network(section *s)
 }
 
 /*
-输入：网络配置文件名
+输入：网络配置文件名，inference 为1时以推理模式构建网络
 功能：解析网络配置文件中的参数，其中超参数赋值给net，而
+     推理模式下(inference为1或配置文件[net]中 inference=1)各层只分配前向计算需要的内存，
+     不分配 delta、权重更新、batchnorm 的训练统计量以及 adam 的动量等，构建出的网络不能训练
 */
-network *parse_network_cfg(char *filename)
+static network *parse_network_cfg_mode(char *filename, int inference)
 {
     list *sections = read_cfg(filename);  // 读取网络配置文件，并存到list中，list的 noede 中 val 中存储的为 section 类型
     node *n = sections->front;
@@ -786,6 +804,7 @@ network *parse_network_cfg(char *filename)
     list *options = s->options;     // section结构体中的 options list存储的是 每个[] 下的所有语句
     if(!is_network(s)) error("First section must be [net] or [network]");
     parse_net_options(options, net);  // 对网络的超参数进行解析
+    if(inference) net->inference = 1;
 
     // 对 params 中的所有变量值进行初始化
     params.h = net->h;
@@ -799,6 +818,7 @@ network *parse_network_cfg(char *filename)
     size_t workspace_size = 0;
     n = n->next;
     int count = 0;
+    int *auto_winograd = calloc(net->n, sizeof(int));  // 需要自动选择Winograd的卷积层
     free_section(s); //释放此时的 s 结构体所占用的内存，因为 node *n 目前还在使用，所以不能释放
     fprintf(stderr, "layer     filters    size              input                output\n");
     while(n){
@@ -882,6 +902,7 @@ network *parse_network_cfg(char *filename)
         l.dontloadscales = option_find_int_quiet(options, "dontloadscales", 0);
         l.learning_rate_scale = option_find_float_quiet(options, "learning_rate", 1);
         l.smooth = option_find_float_quiet(options, "smooth", 0);
+        if(lt == CONVOLUTIONAL && net->winograd < 0 && !option_find(options, "winograd")) auto_winograd[count] = 1;
         option_unused(options); // 每次执行上面 option_find_ 函数都会将节点中的每一项的used置为1，这行打印没有解析过的语句
         net->layers[count] = l; // 之前 make_network 函数分配了一个指针大小，这里将该指针指向了 l，l在上述子函数中已经分配了大小
         if (l.workspace_size > workspace_size) workspace_size = l.workspace_size; // 在 cuda 中使用
@@ -896,13 +917,22 @@ network *parse_network_cfg(char *filename)
         }
     }
     free_list(sections);
+    // 推理网络中没有设置 winograd 的卷积层自动使用 F(2x2,3x3)，
+    // 但只选 Winograd 的工作空间不超过整个网络本来就要分配的工作空间的层，不增加内存
+    for(count = 0; count < net->n; ++count){
+        layer *l = net->layers + count;
+        if(!net->inference || !auto_winograd[count]) continue;
+        size_t tail = l->batch_normalize ? 2*l->n*sizeof(float) : 0;  // 工作空间末尾的 batchnorm 系数
+        if(winograd_fits_workspace(*l, WINOGRAD_F2, workspace_size - tail)) set_convolutional_winograd(l, WINOGRAD_F2);
+    }
+    free(auto_winograd);
     layer out = get_network_output_layer(net);
     net->outputs = out.outputs;
     net->truths = out.outputs;
     if(net->layers[net->n-1].truths) net->truths = net->layers[net->n-1].truths;
     net->output = out.output;
     net->input = calloc(net->inputs*net->batch, sizeof(float));
-    net->truth = calloc(net->truths*net->batch, sizeof(float));
+    if(!net->inference) net->truth = calloc(net->truths*net->batch, sizeof(float));
 #ifdef GPU
     net->output_gpu = out.output_gpu;
     net->input_gpu = cuda_make_array(net->input, net->inputs*net->batch);
@@ -923,6 +953,20 @@ network *parse_network_cfg(char *filename)
     return net;
 }
 
+network *parse_network_cfg(char *filename)
+{
+    return parse_network_cfg_mode(filename, 0);
+}
+
+/*
+输入：网络配置文件名
+功能：以推理模式解析网络配置文件，各层不分配训练用的内存，见 parse_network_cfg_mode
+*/
+network *parse_network_cfg_inference(char *filename)
+{
+    return parse_network_cfg_mode(filename, 1);
+}
+
 /*
 输入：文件名
 功能：读取网络配置文件
@@ -1247,6 +1291,7 @@ void load_convolutional_weights(layer l, FILE *fp)
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
     //if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
+    transform_winograd_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_convolutional_layer(l);
@@ -1350,3 +1395,217 @@ void load_weights(network *net, char *filename)
     load_weights_upto(net, filename, 0, net->n);
 }
 
+/*
+映射加载权重：
+    权重文件整个 mmap 到内存中(MAP_PRIVATE，可写)，各层的 weights、biases、scales、rolling_mean、rolling_variance
+    直接指向映射中对应的位置，不再分配、复制。同一台机器上的多个进程共用页缓存中的同一份权重，
+    启动时也只在第一次访问时按页读入。之后在原地修改权重(翻转、转置、折叠batchnorm、训练更新)只会复制被写到的页，
+    不影响文件和其他进程。映射由网络持有，在 free_network 中释放。
+*/
+typedef struct{
+    char *data;     // 映射的起始地址
+    size_t size;    // 文件大小
+    size_t pos;     // 当前读到的位置
+    int share;      // 为1时数组直接指向映射，为0时复制
+} weights_map;
+
+/*
+输入：映射 m，数组 *dst(由 make_xxx_layer 分配，n 个float)
+功能：取出映射中接下来的 n 个float。m->share 为1时释放 *dst，改为直接指向映射；
+     否则与 fread 一样复制到 *dst 中。文件不够长时只复制剩下的部分
+输出：*dst
+*/
+static void map_floats(weights_map *m, float **dst, size_t n)
+{
+    size_t bytes = n*sizeof(float);
+    size_t left = m->size - m->pos;
+    if(m->share && bytes && bytes <= left){  // 空数组不指向映射，unmap_weights 只需要检查 [begin, end)
+        free(*dst);
+        *dst = (float *)(m->data + m->pos);
+    } else {
+        memcpy(*dst, m->data + m->pos, bytes < left ? bytes : left);
+    }
+    m->pos += bytes < left ? bytes : left;
+}
+
+// 与 load_convolutional_weights 相同，只是从映射中读取
+static void map_convolutional_weights(layer *l, weights_map *m)
+{
+    int share = m->share;
+    int n = l->numload ? l->numload : l->n;
+    if(l->numload) m->share = 0;  // 只加载前 numload 个卷积核，数组的大小与文件中不一致
+    map_floats(m, &l->biases, n);
+    if (l->batch_normalize && (!l->dontloadscales)){
+        map_floats(m, &l->scales, n);
+        map_floats(m, &l->rolling_mean, n);
+        map_floats(m, &l->rolling_variance, n);
+    }
+    map_floats(m, &l->weights, (size_t)l->c/l->groups*n*l->size*l->size);
+    m->share = share;
+    if (l->flipped) {
+        transpose_matrix(l->weights, l->c*l->size*l->size, n);
+    }
+    transform_winograd_weights(*l);
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_convolutional_layer(*l);
+    }
+#endif
+}
+
+// 与 load_connected_weights 相同，只是从映射中读取
+static void map_connected_weights(layer *l, weights_map *m, int transpose)
+{
+    map_floats(m, &l->biases, l->outputs);
+    map_floats(m, &l->weights, (size_t)l->outputs*l->inputs);
+    if(transpose){
+        transpose_matrix(l->weights, l->inputs, l->outputs);
+    }
+    if (l->batch_normalize && (!l->dontloadscales)){
+        map_floats(m, &l->scales, l->outputs);
+        map_floats(m, &l->rolling_mean, l->outputs);
+        map_floats(m, &l->rolling_variance, l->outputs);
+    }
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_connected_layer(*l);
+    }
+#endif
+}
+
+/*
+输入：网络 net，权重文件名 filename
+功能：与 load_weights 的结果相同，但用 mmap 读取，卷积层、全连接层、batchnorm层和local层的数组直接指向映射。
+     rnn、lstm等层内部子层的权重仍然复制，free_network 只需要检查顶层的各层
+输出：各层的权重，net->weights_map，net->weights_map_size
+*/
+void load_weights_mapped(network *net, char *filename)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        cuda_set_device(net->gpu_index);
+    }
+#endif
+    if(net->weights_map){
+        // 已经映射过：各层的数组在原来的映射中，直接读进去即可
+        load_weights(net, filename);
+        return;
+    }
+    fprintf(stderr, "Mapping weights from %s...", filename);
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < 4*(off_t)sizeof(int)) file_error(filename);
+    void *data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) file_error(filename);
+    net->weights_map = data;
+    net->weights_map_size = st.st_size;
+
+    weights_map m = {0};
+    m.data = data;
+    m.size = st.st_size;
+    int header[3];
+    memcpy(header, m.data, sizeof(header));
+    m.pos = sizeof(header);
+    int major = header[0];
+    int minor = header[1];
+    if ((major*10 + minor) >= 2 && major < 1000 && minor < 1000 && m.size >= m.pos + sizeof(size_t)){
+        memcpy(net->seen, m.data + m.pos, sizeof(size_t));
+        m.pos += sizeof(size_t);
+    } else {
+        int iseen = 0;
+        memcpy(&iseen, m.data + m.pos, sizeof(int));
+        m.pos += sizeof(int);
+        *net->seen = iseen;
+    }
+    int transpose = (major > 1000) || (minor > 1000);
+
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if (l->dontload) continue;
+        m.share = 1;
+        if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+            map_convolutional_weights(l, &m);
+        }
+        if(l->type == CONNECTED){
+            map_connected_weights(l, &m, transpose);
+        }
+        if(l->type == BATCHNORM){
+            map_floats(&m, &l->scales, l->c);
+            map_floats(&m, &l->rolling_mean, l->c);
+            map_floats(&m, &l->rolling_variance, l->c);
+#ifdef GPU
+            if(gpu_index >= 0){
+                push_batchnorm_layer(*l);
+            }
+#endif
+        }
+        m.share = 0;
+        if(l->type == CRNN){
+            map_convolutional_weights(l->input_layer, &m);
+            map_convolutional_weights(l->self_layer, &m);
+            map_convolutional_weights(l->output_layer, &m);
+        }
+        if(l->type == RNN){
+            map_connected_weights(l->input_layer, &m, transpose);
+            map_connected_weights(l->self_layer, &m, transpose);
+            map_connected_weights(l->output_layer, &m, transpose);
+        }
+        if (l->type == LSTM) {
+            map_connected_weights(l->wi, &m, transpose);
+            map_connected_weights(l->wf, &m, transpose);
+            map_connected_weights(l->wo, &m, transpose);
+            map_connected_weights(l->wg, &m, transpose);
+            map_connected_weights(l->ui, &m, transpose);
+            map_connected_weights(l->uf, &m, transpose);
+            map_connected_weights(l->uo, &m, transpose);
+            map_connected_weights(l->ug, &m, transpose);
+        }
+        if (l->type == GRU) {
+            map_connected_weights(l->wz, &m, transpose);
+            map_connected_weights(l->wr, &m, transpose);
+            map_connected_weights(l->wh, &m, transpose);
+            map_connected_weights(l->uz, &m, transpose);
+            map_connected_weights(l->ur, &m, transpose);
+            map_connected_weights(l->uh, &m, transpose);
+        }
+        if(l->type == LOCAL){
+            m.share = 1;
+            map_floats(&m, &l->biases, l->outputs);
+            map_floats(&m, &l->weights, (size_t)l->size*l->size*l->c*l->n*l->out_w*l->out_h);
+#ifdef GPU
+            if(gpu_index >= 0){
+                push_local_layer(*l);
+            }
+#endif
+        }
+    }
+    fprintf(stderr, "Done!\n");
+}
+
+/*
+输入：网络 net
+功能：释放 load_weights_mapped 建立的映射。指向映射的各层数组置为0，之后 free_layer 不会再释放它们
+输出：各层的权重，net->weights_map
+*/
+void unmap_weights(network *net)
+{
+    int i, j;
+    if(!net->weights_map) return;
+    char *begin = net->weights_map;
+    char *end = begin + net->weights_map_size;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        float **arrays[] = {&l->weights, &l->biases, &l->scales, &l->rolling_mean, &l->rolling_variance};
+        for(j = 0; j < sizeof(arrays)/sizeof(arrays[0]); ++j){
+            char *p = (char *)*arrays[j];
+            if(p >= begin && p < end) *arrays[j] = 0;
+        }
+    }
+    munmap(net->weights_map, net->weights_map_size);
+    net->weights_map = 0;
+    net->weights_map_size = 0;
+}
+
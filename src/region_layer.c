@@ -10,7 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-layer make_region_layer(int batch, int w, int h, int n, int classes, int coords)
+layer make_region_layer(int batch, int w, int h, int n, int classes, int coords, int inference)
 {
     layer l = {0};
     l.type = REGION;
@@ -31,7 +31,7 @@ layer make_region_layer(int batch, int w, int h, int n, int classes, int coords)
     l.outputs = h*w*n*(classes + coords + 1);
     l.inputs = l.outputs;
     l.truths = 30*(l.coords + 1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(!inference) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     int i;
     for(i = 0; i < n*2; ++i){
@@ -62,7 +62,7 @@ void resize_region_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -185,8 +185,8 @@ void forward_region_layer(const layer l, network net)
     }
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     float avg_iou = 0;
     float recall = 0;
     float avg_cat = 0;
@@ -6,7 +6,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse, int flatten, int extra);
+layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse, int flatten, int extra, int inference);
 void resize_reorg_layer(layer *l, int w, int h);
 void forward_reorg_layer(const layer l, network net);
 void backward_reorg_layer(const layer l, network net);
@@ -4,7 +4,7 @@
 
 #include <stdio.h>
 
-route_layer make_route_layer(int batch, int n, int *input_layers, int *input_sizes)
+route_layer make_route_layer(int batch, int n, int *input_layers, int *input_sizes, int inference)
 {
     fprintf(stderr,"route ");
     route_layer l = {0};
@@ -22,7 +22,7 @@ route_layer make_route_layer(int batch, int n, int *input_layers, int *input_siz
     fprintf(stderr, "\n");
     l.outputs = outputs;
     l.inputs = outputs;
-    l.delta =  calloc(outputs*batch, sizeof(float));
+    if(!inference) l.delta = calloc(outputs*batch, sizeof(float));
     l.output = calloc(outputs*batch, sizeof(float));;
 
     l.forward = forward_route_layer;
@@ -59,7 +59,7 @@ void resize_route_layer(route_layer *l, network *net)
         }
     }
     l->inputs = l->outputs;
-    l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->outputs*l->batch*sizeof(float));
     l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
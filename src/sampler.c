@@ -0,0 +1,109 @@
+#include "sampler.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+按 epoch 打乱的无放回采样：
+    每个 epoch 使用一个由 (seed, epoch) 决定的 [0,m) 上的随机置换，依次取完之后进入下一个 epoch，
+    每个样本在一个 epoch 中恰好出现一次。置换用 Feistel 网络直接计算，不需要保存打乱后的数组，
+    也不需要在 epoch 之间重新洗牌，加载线程只通过一次原子加法分配位置，相互之间没有锁。
+    多个进程使用相同的 seed 时得到相同的置换，按 rank 交错分片之后互不重叠。
+*/
+
+static uint32_t sampler_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/*
+输入：采样器 s，位置 i(< 2^(2*half_bits))，epoch
+功能：4轮 Feistel 网络，是 [0, 2^(2*half_bits)) 上的一个置换，轮函数的密钥由 seed 和 epoch 决定
+*/
+static uint32_t sampler_feistel(sampler *s, uint32_t i, uint32_t epoch)
+{
+    uint32_t mask = (1u << s->half_bits) - 1;
+    uint32_t l = i >> s->half_bits;
+    uint32_t r = i & mask;
+    int round;
+    for(round = 0; round < 4; ++round){
+        uint32_t key = sampler_hash(s->seed ^ sampler_hash(epoch*4 + round));
+        uint32_t t = l ^ (sampler_hash(r ^ key) & mask);
+        l = r;
+        r = t;
+    }
+    return (l << s->half_bits) | r;
+}
+
+/*
+输入：采样器 s，位置 i(< m)，epoch
+功能：[0,m) 上的置换：在更大的范围上做 Feistel 置换，结果不小于 m 时继续置换直到落在 [0,m) 中(cycle walking)
+*/
+static int sampler_permute(sampler *s, uint32_t i, uint32_t epoch)
+{
+    do{
+        i = sampler_feistel(s, i, epoch);
+    } while(i >= (uint32_t)s->m);
+    return i;
+}
+
+/*
+输入：样本总数 m，本进程的序号 rank 和进程总数 world(单进程训练为 0 和 1)，随机种子 seed
+功能：创建采样器，多个进程训练时各个进程的 seed 必须相同。每个进程每个 epoch 取 m/world 个样本，不能整除时每个 epoch 随机跳过 m%world 个样本
+返回：采样器，用 free_sampler 释放
+*/
+sampler *make_sampler(int m, int rank, int world, unsigned int seed)
+{
+    if(m <= 0) error("Sampler needs at least one sample");
+    if(world < 1) world = 1;
+    if(rank < 0 || rank >= world) error("Sampler rank out of range");
+    sampler *s = calloc(1, sizeof(sampler));
+    s->m = m;
+    s->rank = rank;
+    s->world = world;
+    s->size = m/world;
+    if(s->size < 1) s->size = 1;
+    s->seed = seed;
+    s->half_bits = 1;
+    while(((int64_t)1 << (2*s->half_bits)) < m) ++s->half_bits;
+    s->next = 0;
+    return s;
+}
+
+void free_sampler(sampler *s)
+{
+    free(s);
+}
+
+/*
+输入：采样器 s，需要的样本数 n
+功能：取出接下来的 n 个样本序号，可以在多个加载线程中同时调用
+输出：indexes
+*/
+void sampler_next(sampler *s, int *indexes, int n)
+{
+    int64_t start = __sync_fetch_and_add(&s->next, (int64_t)n);
+    int i;
+    for(i = 0; i < n; ++i){
+        int64_t p = start + i;
+        uint32_t epoch = p / s->size;
+        int64_t k = p % s->size;
+        int64_t j = s->rank + k*s->world;
+        if(j >= s->m) j %= s->m;
+        indexes[i] = sampler_permute(s, j, epoch);
+    }
+}
+
+/*
+功能：返回当前所在的 epoch(从0开始)，即已经取出的样本个数除以每个 epoch 的样本数
+*/
+int sampler_epoch(sampler *s)
+{
+    return s->next / s->size;
+}
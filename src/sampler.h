@@ -0,0 +1,17 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "darknet.h"
+
+#include <stdint.h>
+
+struct sampler{
+    int m;                  // 样本总数
+    int rank, world;        // 本进程的序号和进程总数，每个进程取打乱后序列中的第 rank, rank+world, ... 个
+    int size;               // 每个 epoch 本进程取到的样本数
+    uint32_t seed;
+    int half_bits;          // 置换在 [0, 2^(2*half_bits)) 上进行，再跳过不小于 m 的值
+    volatile int64_t next;  // 已经取出的样本个数，多个加载线程用原子加法分配
+};
+
+#endif
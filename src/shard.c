@@ -0,0 +1,254 @@
+#include "shard.h"
+#include "utils.h"
+#include "image.h"
+#include "data.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+预处理好的检测数据集分片：
+    每个分片文件依次存放解码后的 uint8 像素和对应的标签框，文件末尾是索引表，
+    训练时 mmap 整个分片，按索引直接取出样本，不再打开、解码每张小图片和解析标签文本。
+    由 darknet dataset pack 生成，在 .data 文件中用 shards= 指定分片列表。
+*/
+
+/*
+输入：索引表中的一项 e，样本数据的结束位置 limit(即索引表的偏移)
+功能：检查样本的像素和标签框都在 [0, limit) 之内，避免损坏或不完整的分片在取样本时读到映射之外
+返回：合法返回1，否则返回0
+*/
+static int valid_shard_entry(shard_entry e, uint64_t limit)
+{
+    if(e.w <= 0 || e.h <= 0 || e.c <= 0 || e.nboxes < 0) return 0;
+    if(e.offset > limit) return 0;
+    uint64_t left = limit - e.offset;
+    uint64_t pixels = (uint64_t)e.w*e.h;
+    if(pixels > left || pixels*e.c > left) return 0;
+    left -= pixels*e.c;
+    return (uint64_t)e.nboxes <= left/sizeof(shard_box);
+}
+
+/*
+输入：分片文件路径列表 paths，个数 n
+功能：mmap 所有分片并合并它们的索引，索引中的每一项都检查是否在文件之内
+返回：分片集合，用 free_shards 释放
+*/
+shard_set *open_shards(char **paths, int n)
+{
+    int i, j;
+    shard_set *s = calloc(1, sizeof(shard_set));
+    s->n = n;
+    s->maps = calloc(n, sizeof(unsigned char *));
+    s->sizes = calloc(n, sizeof(size_t));
+    for(i = 0; i < n; ++i){
+        int fd = open(paths[i], O_RDONLY);
+        if(fd < 0) file_error(paths[i]);
+        struct stat st;
+        if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(shard_header)) file_error(paths[i]);
+        s->sizes[i] = st.st_size;
+        void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) file_error(paths[i]);
+        s->maps[i] = map;
+
+        shard_header h;
+        memcpy(&h, map, sizeof(h));
+        if(memcmp(h.magic, SHARD_MAGIC, 8) || h.version != SHARD_VERSION){
+            fprintf(stderr, "Not a shard file: %s\n", paths[i]);
+            error("Bad shard");
+        }
+        if(h.count < 0 || h.index_offset > s->sizes[i] ||
+                (uint64_t)h.count > (s->sizes[i] - h.index_offset)/sizeof(shard_entry)){
+            fprintf(stderr, "Truncated shard file: %s\n", paths[i]);
+            error("Bad shard");
+        }
+        s->entries = realloc(s->entries, (s->count + h.count)*sizeof(shard_entry));
+        s->file = realloc(s->file, (s->count + h.count)*sizeof(int));
+        memcpy(s->entries + s->count, s->maps[i] + h.index_offset, h.count*sizeof(shard_entry));
+        for(j = 0; j < h.count; ++j){
+            if(!valid_shard_entry(s->entries[s->count + j], h.index_offset)){
+                fprintf(stderr, "Corrupt entry %d in shard file: %s\n", j, paths[i]);
+                error("Bad shard");
+            }
+        }
+        for(j = 0; j < h.count; ++j) s->file[s->count + j] = i;
+        s->count += h.count;
+    }
+    fprintf(stderr, "Opened %d shards with %d samples\n", n, s->count);
+    return s;
+}
+
+/*
+输入：分片列表文件，每行一个分片文件路径
+功能：读取列表并打开其中所有分片
+*/
+shard_set *open_shard_list(char *filename)
+{
+    list *plist = get_paths(filename);
+    char **paths = (char **)list_to_array(plist);
+    shard_set *s = open_shards(paths, plist->size);
+    free_ptrs((void **)paths, plist->size);
+    free_list(plist);
+    return s;
+}
+
+void free_shards(shard_set *s)
+{
+    int i;
+    for(i = 0; i < s->n; ++i) munmap(s->maps[i], s->sizes[i]);
+    free(s->maps);
+    free(s->sizes);
+    free(s->entries);
+    free(s->file);
+    free(s);
+}
+
+/*
+功能：返回分片集合中的样本总数
+*/
+int shard_count(shard_set *s)
+{
+    return s->count;
+}
+
+/*
+输入：分片集合 s，样本序号 i
+功能：取出第 i 个样本的 uint8 图像，直接指向 mmap 的分片，不复制
+返回：图像，不需要也不能释放，在 free_shards 之前有效
+*/
+image_u8 get_shard_image(shard_set *s, int i)
+{
+    shard_entry e = s->entries[i];
+    image_u8 im;
+    im.w = e.w;
+    im.h = e.h;
+    im.c = e.c;
+    im.data = s->maps[s->file[i]] + e.offset;
+    return im;
+}
+
+/*
+输入：分片集合 s，样本序号 i
+功能：取出第 i 个样本的标签框，与 read_boxes 读取标签文件的结果相同
+返回：新分配的标签框数组，个数写入 *n
+*/
+box_label *load_shard_boxes(shard_set *s, int i, int *n)
+{
+    shard_entry e = s->entries[i];
+    unsigned char *p = s->maps[s->file[i]] + e.offset + (size_t)e.w*e.h*e.c;
+    box_label *boxes = calloc(e.nboxes ? e.nboxes : 1, sizeof(box_label));
+    int j;
+    for(j = 0; j < e.nboxes; ++j){
+        shard_box b;
+        memcpy(&b, p + j*sizeof(shard_box), sizeof(shard_box));  // 像素之后的位置不一定对齐
+        boxes[j].id = b.id;
+        boxes[j].x = b.x;
+        boxes[j].y = b.y;
+        boxes[j].w = b.w;
+        boxes[j].h = b.h;
+        boxes[j].left   = b.x - b.w/2;
+        boxes[j].right  = b.x + b.w/2;
+        boxes[j].top    = b.y - b.h/2;
+        boxes[j].bottom = b.y + b.h/2;
+    }
+    *n = e.nboxes;
+    return boxes;
+}
+
+static void shard_write(FILE *fp, void *p, size_t n, char *filename)
+{
+    if(fwrite(p, 1, n, fp) != n) file_error(filename);
+}
+
+/*
+输入：训练图片列表 train_list，输出分片的前缀 prefix，每个分片的样本数 per_shard，
+     max_dim 大于0时把长边超过 max_dim 的图片等比例缩小到 max_dim(标签是相对坐标，不受影响)
+功能：把列表中的图片解码成 uint8 像素，连同 labels 目录下对应的标签一起写入 prefix_00000.shard 等分片文件，
+     并把所有分片的路径写入 prefix.shards，作为 .data 文件中 shards= 的值
+*/
+void pack_detection_shards(char *train_list, char *prefix, int per_shard, int max_dim)
+{
+    list *plist = get_paths(train_list);
+    char **paths = (char **)list_to_array(plist);
+    int n = plist->size;
+    if(per_shard <= 0) per_shard = n;
+    int nshards = (n + per_shard - 1)/per_shard;
+    int i, j, k;
+
+    char listname[4096];
+    if(snprintf(listname, sizeof(listname), "%s.shards", prefix) >= (int)sizeof(listname)) error("Shard prefix is too long");
+    FILE *list_fp = fopen(listname, "w");
+    if(!list_fp) file_error(listname);
+
+    for(k = 0; k < nshards; ++k){
+        char filename[4096];
+        if(snprintf(filename, sizeof(filename), "%s_%05d.shard", prefix, k) >= (int)sizeof(filename)) error("Shard prefix is too long");
+        FILE *fp = fopen(filename, "wb");
+        if(!fp) file_error(filename);
+        int start = k*per_shard;
+        int count = (start + per_shard > n) ? n - start : per_shard;
+        shard_entry *entries = calloc(count, sizeof(shard_entry));
+        shard_header h = {{0}};
+        memcpy(h.magic, SHARD_MAGIC, 8);
+        h.version = SHARD_VERSION;
+        h.count = count;
+        shard_write(fp, &h, sizeof(h), filename);
+        uint64_t offset = sizeof(h);
+        for(i = 0; i < count; ++i){
+            char *path = paths[start + i];
+            image_u8 im = load_image_u8(path, 0, 0, 3);
+            if(max_dim > 0 && (im.w > max_dim || im.h > max_dim)){
+                int w = (im.w >= im.h) ? max_dim : im.w*max_dim/im.h;
+                int h2 = (im.h > im.w) ? max_dim : im.h*max_dim/im.w;
+                image_u8 sized = resize_image_u8(im, w > 0 ? w : 1, h2 > 0 ? h2 : 1);
+                free_image_u8(im);
+                im = sized;
+            }
+            size_t npix = (size_t)im.w*im.h*im.c;
+
+            char labelpath[4096];
+            detection_label_path(path, labelpath);
+            int nboxes = 0;
+            box_label *boxes = read_boxes(labelpath, &nboxes);
+            shard_box *sb = calloc(nboxes ? nboxes : 1, sizeof(shard_box));
+            for(j = 0; j < nboxes; ++j){
+                sb[j].x = boxes[j].x;
+                sb[j].y = boxes[j].y;
+                sb[j].w = boxes[j].w;
+                sb[j].h = boxes[j].h;
+                sb[j].id = boxes[j].id;
+            }
+
+            entries[i].offset = offset;
+            entries[i].w = im.w;
+            entries[i].h = im.h;
+            entries[i].c = im.c;
+            entries[i].nboxes = nboxes;
+            shard_write(fp, im.data, npix, filename);
+            shard_write(fp, sb, nboxes*sizeof(shard_box), filename);
+            offset += npix + nboxes*sizeof(shard_box);
+
+            free(sb);
+            free(boxes);
+            free_image_u8(im);
+            if((start + i + 1) % 1000 == 0) fprintf(stderr, "%d/%d\n", start + i + 1, n);
+        }
+        h.index_offset = offset;
+        shard_write(fp, entries, count*sizeof(shard_entry), filename);
+        fseek(fp, 0, SEEK_SET);
+        shard_write(fp, &h, sizeof(h), filename);
+        fclose(fp);
+        free(entries);
+        fprintf(list_fp, "%s\n", filename);
+        fprintf(stderr, "Wrote %s: %d images, %.1f MB\n", filename, count, (offset + count*sizeof(shard_entry))/1048576.);
+    }
+    fclose(list_fp);
+    free_ptrs((void **)paths, n);
+    free_list(plist);
+}
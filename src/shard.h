@@ -0,0 +1,43 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "darknet.h"
+
+#include <stdint.h>
+
+#define SHARD_MAGIC "DNSHARD1"
+#define SHARD_VERSION 1
+
+// 分片文件开头的文件头
+typedef struct{
+    char magic[8];
+    int32_t version;
+    int32_t count;          // 样本个数
+    uint64_t index_offset;  // 索引表在文件中的偏移
+} shard_header;
+
+// 索引表中的一项，索引表位于所有样本之后
+typedef struct{
+    uint64_t offset;        // 样本在文件中的偏移
+    int32_t w, h, c;        // 像素按 c x h x w 的 uint8 存放
+    int32_t nboxes;         // 像素之后紧跟 nboxes 个 shard_box
+} shard_entry;
+
+typedef struct{
+    float x, y, w, h;
+    int32_t id;
+} shard_box;
+
+struct shard_set{
+    int n;                  // 分片文件个数
+    unsigned char **maps;   // 每个分片 mmap 之后的起始地址
+    size_t *sizes;
+    int count;              // 所有分片中的样本总数
+    shard_entry *entries;   // 所有样本的索引，offset 已经换算成相对 maps[file[i]] 的偏移
+    int *file;              // 每个样本所在的分片
+};
+
+image_u8 get_shard_image(shard_set *s, int i);
+box_label *load_shard_boxes(shard_set *s, int i, int *n);
+
+#endif
@@ -0,0 +1,503 @@
+#include "simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+cpu_features cpu_feature = {0};
+simd_ops simd = {0};
+
+/*
+只在x86上用gcc/clang的 target 属性编译AVX2、AVX-512版本的函数，这样整个库仍然按通用指令集编译，
+不支持这些指令的机器只要不调用这些函数就不会出错，是否调用由 simd_init() 运行时检测CPU特性决定。
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef SIMD_X86
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx2,fma")))
+// 不开启fma，编译器不会把乘法和加减法合并成fma，结果与标量计算逐位相同
+#define AVX2_EXACT_TARGET __attribute__((target("avx2")))
+
+/*
+输入：*c C子块中一行的首地址
+     lo,hi 该行16个元素的累加结果
+     accumulate 为0时直接写回，否则加上C中原来的值
+     *ep 尾处理，为0时不做；i 为该行在子块中的行号
+功能：在寄存器中完成尾处理后写回C的一行，LINEAR/RELU/LEAKY/RELIE直接用向量指令，其余激活函数写回后逐个计算
+输出：C的一行
+返回：无
+*/
+AVX2_TARGET static inline void gemm_store_row_avx2(float *c, __m256 lo, __m256 hi, int accumulate, const gemm_epilogue *ep, int i)
+{
+    int j;
+    if(accumulate){
+        lo = _mm256_add_ps(_mm256_loadu_ps(c), lo);
+        hi = _mm256_add_ps(_mm256_loadu_ps(c + 8), hi);
+    }
+    if(ep){
+        if(ep->scales){
+            __m256 s = _mm256_set1_ps(ep->scales[i]);
+            lo = _mm256_mul_ps(lo, s);
+            hi = _mm256_mul_ps(hi, s);
+        }
+        if(ep->biases){
+            __m256 b = _mm256_set1_ps(ep->biases[i]);
+            lo = _mm256_add_ps(lo, b);
+            hi = _mm256_add_ps(hi, b);
+        }
+        switch(ep->activation){
+            case LINEAR:
+                break;
+            case RELU:
+                lo = _mm256_max_ps(lo, _mm256_setzero_ps());
+                hi = _mm256_max_ps(hi, _mm256_setzero_ps());
+                break;
+            case LEAKY:
+            case RELIE:
+                {
+                    __m256 k = _mm256_set1_ps(ep->activation == LEAKY ? .1f : .01f);
+                    lo = _mm256_max_ps(lo, _mm256_mul_ps(k, lo));
+                    hi = _mm256_max_ps(hi, _mm256_mul_ps(k, hi));
+                }
+                break;
+            default:
+                _mm256_storeu_ps(c, lo);
+                _mm256_storeu_ps(c + 8, hi);
+                for(j = 0; j < 16; ++j) c[j] = activate(c[j], ep->activation);
+                return;
+        }
+    }
+    _mm256_storeu_ps(c, lo);
+    _mm256_storeu_ps(c + 8, hi);
+}
+
+/*
+输入：kc 打包后A、B条带的长度
+     *a 打包后的 6*kc 的A条带
+     *b 打包后的 kc*16 的B条带
+     *c C子块的首地址
+     ldc 矩阵*C一行有多少个元素
+     accumulate,ep 见 simd_ops.gemm_kernel
+功能：AVX2+FMA的 6x16 gemm 微内核，12个ymm寄存器存放C子块，每次读入B的一行(2个ymm)，广播A的一个元素
+输出：C = a*b 或 C += a*b，并做尾处理
+返回：无
+*/
+AVX2_TARGET static void gemm_kernel_avx2(int kc, float *a, float *b, float *c, int ldc, int accumulate, const gemm_epilogue *ep)
+{
+    int p;
+    // 累加器逐个写出来，保证编译器不会把它们放回内存
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for(p = 0; p < kc; ++p){
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        __m256 ai;
+        ai = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+        a += 6;
+        b += 16;
+    }
+    gemm_store_row_avx2(c + 0*ldc, c00, c01, accumulate, ep, 0);
+    gemm_store_row_avx2(c + 1*ldc, c10, c11, accumulate, ep, 1);
+    gemm_store_row_avx2(c + 2*ldc, c20, c21, accumulate, ep, 2);
+    gemm_store_row_avx2(c + 3*ldc, c30, c31, accumulate, ep, 3);
+    gemm_store_row_avx2(c + 4*ldc, c40, c41, accumulate, ep, 4);
+    gemm_store_row_avx2(c + 5*ldc, c50, c51, accumulate, ep, 5);
+}
+
+AVX2_TARGET static void axpy_avx2(int n, float ALPHA, float *X, float *Y)
+{
+    int i = 0;
+    __m256 alpha = _mm256_set1_ps(ALPHA);
+    for(; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(Y + i, _mm256_fmadd_ps(alpha, _mm256_loadu_ps(X + i), _mm256_loadu_ps(Y + i)));
+    }
+    for(; i < n; ++i) Y[i] += ALPHA*X[i];
+}
+
+AVX2_TARGET static void scal_avx2(int n, float ALPHA, float *X)
+{
+    int i = 0;
+    __m256 alpha = _mm256_set1_ps(ALPHA);
+    for(; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(X + i, _mm256_mul_ps(alpha, _mm256_loadu_ps(X + i)));
+    }
+    for(; i < n; ++i) X[i] *= ALPHA;
+}
+
+AVX2_TARGET static void normalize_avx2(float *x, float mean, float stddev, int n)
+{
+    int i = 0;
+    __m256 m = _mm256_set1_ps(mean);
+    __m256 s = _mm256_set1_ps(stddev);
+    for(; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(x + i, _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), m), s));
+    }
+    for(; i < n; ++i) x[i] = (x[i] - mean)/stddev;
+}
+
+AVX2_TARGET static float hsum_avx2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+AVX2_TARGET static float sum_avx2(float *x, int n)
+{
+    int i = 0;
+    __m256 acc = _mm256_setzero_ps();
+    for(; i + 8 <= n; i += 8) acc = _mm256_add_ps(acc, _mm256_loadu_ps(x + i));
+    float sum = hsum_avx2(acc);
+    for(; i < n; ++i) sum += x[i];
+    return sum;
+}
+
+AVX2_TARGET static float sum_sq_diff_avx2(float *x, float mean, int n)
+{
+    int i = 0;
+    __m256 m = _mm256_set1_ps(mean);
+    __m256 acc = _mm256_setzero_ps();
+    for(; i + 8 <= n; i += 8){
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), m);
+        acc = _mm256_fmadd_ps(d, d, acc);
+    }
+    float sum = hsum_avx2(acc);
+    for(; i < n; ++i) sum += (x[i] - mean)*(x[i] - mean);
+    return sum;
+}
+
+/*
+输入：要经过激活函数的数组 *x，大小 n，激活函数 a
+功能：对分段线性的激活函数做向量化，其余激活函数(需要exp等)返回0，由 activate_array 的标量循环处理
+返回：1 已处理，0 未处理
+*/
+AVX2_TARGET static int activate_avx2(float *x, int n, ACTIVATION a)
+{
+    int i = 0;
+    __m256 zero = _mm256_setzero_ps();
+    __m256 k;
+    switch(a){
+        case LINEAR:
+            return 1;
+        case RELU:
+            for(; i + 8 <= n; i += 8) _mm256_storeu_ps(x + i, _mm256_max_ps(_mm256_loadu_ps(x + i), zero));
+            for(; i < n; ++i) x[i] = x[i]*(x[i]>0);
+            return 1;
+        case LEAKY:
+        case RELIE:
+            // x>0 时 x > k*x，x<0 时 k*x > x，所以 max(x, k*x) 即为 leaky/relie
+            k = _mm256_set1_ps(a == LEAKY ? .1f : .01f);
+            for(; i + 8 <= n; i += 8){
+                __m256 v = _mm256_loadu_ps(x + i);
+                _mm256_storeu_ps(x + i, _mm256_max_ps(v, _mm256_mul_ps(k, v)));
+            }
+            for(; i < n; ++i) x[i] = (x[i]>0) ? x[i] : ((a == LEAKY) ? .1f : .01f)*x[i];
+            return 1;
+        case RAMP:
+            k = _mm256_set1_ps(.1f);
+            for(; i + 8 <= n; i += 8){
+                __m256 v = _mm256_loadu_ps(x + i);
+                _mm256_storeu_ps(x + i, _mm256_fmadd_ps(k, v, _mm256_max_ps(v, zero)));
+            }
+            for(; i < n; ++i) x[i] = x[i]*(x[i]>0) + .1f*x[i];
+            return 1;
+        case HARDTAN:
+            for(; i + 8 <= n; i += 8){
+                __m256 v = _mm256_loadu_ps(x + i);
+                _mm256_storeu_ps(x + i, _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-1)), _mm256_set1_ps(1)));
+            }
+            for(; i < n; ++i) x[i] = (x[i] < -1) ? -1 : ((x[i] > 1) ? 1 : x[i]);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+输入：框 a(left,right,top,bottom,面积)，n 个框按 left,right,top,bottom,面积 分开存放
+功能：计算 IoU，运算顺序与 box_intersection、box_union 相同，NMS 的结果不会因为向量化而改变
+输出：iou
+*/
+AVX2_EXACT_TARGET static void box_iou_avx2(const float *a, int n, const float *left, const float *right, const float *top, const float *bot, const float *area, float *iou)
+{
+    int i = 0;
+    __m256 al = _mm256_set1_ps(a[0]);
+    __m256 ar = _mm256_set1_ps(a[1]);
+    __m256 at = _mm256_set1_ps(a[2]);
+    __m256 ab = _mm256_set1_ps(a[3]);
+    __m256 aa = _mm256_set1_ps(a[4]);
+    __m256 zero = _mm256_setzero_ps();
+    for(; i + 8 <= n; i += 8){
+        // _mm256_max_ps(x, y) 即 x > y ? x : y，与标量的 overlap 相同
+        __m256 w = _mm256_sub_ps(_mm256_min_ps(ar, _mm256_loadu_ps(right + i)), _mm256_max_ps(al, _mm256_loadu_ps(left + i)));
+        __m256 h = _mm256_sub_ps(_mm256_min_ps(ab, _mm256_loadu_ps(bot + i)), _mm256_max_ps(at, _mm256_loadu_ps(top + i)));
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_NLT_UQ), _mm256_cmp_ps(h, zero, _CMP_NLT_UQ));
+        __m256 inter = _mm256_and_ps(_mm256_mul_ps(w, h), valid);
+        __m256 u = _mm256_sub_ps(_mm256_add_ps(aa, _mm256_loadu_ps(area + i)), inter);
+        _mm256_storeu_ps(iou + i, _mm256_div_ps(inter, u));
+    }
+    for(; i < n; ++i){
+        float l = a[0] > left[i] ? a[0] : left[i];
+        float r = a[1] < right[i] ? a[1] : right[i];
+        float t = a[2] > top[i] ? a[2] : top[i];
+        float b = a[3] < bot[i] ? a[3] : bot[i];
+        float w = r - l;
+        float h = b - t;
+        float inter = (w < 0 || h < 0) ? 0 : w*h;
+        iou[i] = inter/(a[4] + area[i] - inter);
+    }
+}
+
+/*
+输入：同 gemm_store_row_avx2，lo,hi 为该行32个元素的累加结果
+功能：AVX-512 版本的尾处理与写回
+输出：C的一行
+返回：无
+*/
+AVX512_TARGET static inline void gemm_store_row_avx512(float *c, __m512 lo, __m512 hi, int accumulate, const gemm_epilogue *ep, int i)
+{
+    int j;
+    if(accumulate){
+        lo = _mm512_add_ps(_mm512_loadu_ps(c), lo);
+        hi = _mm512_add_ps(_mm512_loadu_ps(c + 16), hi);
+    }
+    if(ep){
+        if(ep->scales){
+            __m512 s = _mm512_set1_ps(ep->scales[i]);
+            lo = _mm512_mul_ps(lo, s);
+            hi = _mm512_mul_ps(hi, s);
+        }
+        if(ep->biases){
+            __m512 b = _mm512_set1_ps(ep->biases[i]);
+            lo = _mm512_add_ps(lo, b);
+            hi = _mm512_add_ps(hi, b);
+        }
+        switch(ep->activation){
+            case LINEAR:
+                break;
+            case RELU:
+                lo = _mm512_max_ps(lo, _mm512_setzero_ps());
+                hi = _mm512_max_ps(hi, _mm512_setzero_ps());
+                break;
+            case LEAKY:
+            case RELIE:
+                {
+                    __m512 k = _mm512_set1_ps(ep->activation == LEAKY ? .1f : .01f);
+                    lo = _mm512_max_ps(lo, _mm512_mul_ps(k, lo));
+                    hi = _mm512_max_ps(hi, _mm512_mul_ps(k, hi));
+                }
+                break;
+            default:
+                _mm512_storeu_ps(c, lo);
+                _mm512_storeu_ps(c + 16, hi);
+                for(j = 0; j < 32; ++j) c[j] = activate(c[j], ep->activation);
+                return;
+        }
+    }
+    _mm512_storeu_ps(c, lo);
+    _mm512_storeu_ps(c + 16, hi);
+}
+
+/*
+输入：同 gemm_kernel_avx2
+功能：AVX-512 的 8x32 gemm 微内核，16个zmm寄存器存放C子块，每次读入B的一行(2个zmm)，广播A的一个元素
+输出：C = a*b 或 C += a*b，并做尾处理
+返回：无
+*/
+AVX512_TARGET static void gemm_kernel_avx512(int kc, float *a, float *b, float *c, int ldc, int accumulate, const gemm_epilogue *ep)
+{
+    int i, p;
+    __m512 acc[8][2];
+    for(i = 0; i < 8; ++i){
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for(p = 0; p < kc; ++p){
+        __m512 b0 = _mm512_loadu_ps(b);
+        __m512 b1 = _mm512_loadu_ps(b + 16);
+        for(i = 0; i < 8; ++i){
+            __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+        a += 8;
+        b += 32;
+    }
+    for(i = 0; i < 8; ++i){
+        gemm_store_row_avx512(c + i*ldc, acc[i][0], acc[i][1], accumulate, ep, i);
+    }
+}
+
+AVX512_TARGET static void axpy_avx512(int n, float ALPHA, float *X, float *Y)
+{
+    int i = 0;
+    __m512 alpha = _mm512_set1_ps(ALPHA);
+    for(; i + 16 <= n; i += 16){
+        _mm512_storeu_ps(Y + i, _mm512_fmadd_ps(alpha, _mm512_loadu_ps(X + i), _mm512_loadu_ps(Y + i)));
+    }
+    for(; i < n; ++i) Y[i] += ALPHA*X[i];
+}
+
+AVX512_TARGET static void scal_avx512(int n, float ALPHA, float *X)
+{
+    int i = 0;
+    __m512 alpha = _mm512_set1_ps(ALPHA);
+    for(; i + 16 <= n; i += 16){
+        _mm512_storeu_ps(X + i, _mm512_mul_ps(alpha, _mm512_loadu_ps(X + i)));
+    }
+    for(; i < n; ++i) X[i] *= ALPHA;
+}
+
+AVX512_TARGET static void normalize_avx512(float *x, float mean, float stddev, int n)
+{
+    int i = 0;
+    __m512 m = _mm512_set1_ps(mean);
+    __m512 s = _mm512_set1_ps(stddev);
+    for(; i + 16 <= n; i += 16){
+        _mm512_storeu_ps(x + i, _mm512_div_ps(_mm512_sub_ps(_mm512_loadu_ps(x + i), m), s));
+    }
+    for(; i < n; ++i) x[i] = (x[i] - mean)/stddev;
+}
+
+AVX512_TARGET static float sum_avx512(float *x, int n)
+{
+    int i = 0;
+    __m512 acc = _mm512_setzero_ps();
+    for(; i + 16 <= n; i += 16) acc = _mm512_add_ps(acc, _mm512_loadu_ps(x + i));
+    float sum = _mm512_reduce_add_ps(acc);
+    for(; i < n; ++i) sum += x[i];
+    return sum;
+}
+
+AVX512_TARGET static float sum_sq_diff_avx512(float *x, float mean, int n)
+{
+    int i = 0;
+    __m512 m = _mm512_set1_ps(mean);
+    __m512 acc = _mm512_setzero_ps();
+    for(; i + 16 <= n; i += 16){
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), m);
+        acc = _mm512_fmadd_ps(d, d, acc);
+    }
+    float sum = _mm512_reduce_add_ps(acc);
+    for(; i < n; ++i) sum += (x[i] - mean)*(x[i] - mean);
+    return sum;
+}
+
+AVX512_TARGET static int activate_avx512(float *x, int n, ACTIVATION a)
+{
+    int i = 0;
+    __m512 zero = _mm512_setzero_ps();
+    __m512 k;
+    switch(a){
+        case LEAKY:
+        case RELIE:
+            k = _mm512_set1_ps(a == LEAKY ? .1f : .01f);
+            for(; i + 16 <= n; i += 16){
+                __m512 v = _mm512_loadu_ps(x + i);
+                _mm512_storeu_ps(x + i, _mm512_max_ps(v, _mm512_mul_ps(k, v)));
+            }
+            for(; i < n; ++i) x[i] = (x[i]>0) ? x[i] : ((a == LEAKY) ? .1f : .01f)*x[i];
+            return 1;
+        case RELU:
+            for(; i + 16 <= n; i += 16) _mm512_storeu_ps(x + i, _mm512_max_ps(_mm512_loadu_ps(x + i), zero));
+            for(; i < n; ++i) x[i] = x[i]*(x[i]>0);
+            return 1;
+        default:
+            // 其余激活函数使用AVX2版本，AVX-512 的机器一定支持AVX2
+            return activate_avx2(x, n, a);
+    }
+}
+
+#endif
+
+char *get_simd_string(SIMD_LEVEL level)
+{
+    switch(level){
+        case SIMD_SSE4:
+            return "sse4";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        default:
+            break;
+    }
+    return "generic";
+}
+
+/*
+输入：无
+功能：检测CPU支持的指令集，并据此填充函数表 simd。
+     环境变量 DARKNET_SIMD=generic/sse4/avx2/avx512 可以限制使用的最高指令集，用于排查问题或对比性能。
+     在gcc/clang下该函数会在程序启动时自动调用，重复调用没有副作用。
+     SSE4只做检测，对应的函数仍是通用版本(编译器已经用SSE2对通用版本做了自动向量化)。
+输出：无
+*/
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+#endif
+void simd_init()
+{
+    SIMD_LEVEL max = SIMD_AVX512;
+    char *env = getenv("DARKNET_SIMD");
+    if(env){
+        if(strcmp(env, "generic") == 0) max = SIMD_GENERIC;
+        else if(strcmp(env, "sse4") == 0) max = SIMD_SSE4;
+        else if(strcmp(env, "avx2") == 0) max = SIMD_AVX2;
+        else if(strcmp(env, "avx512") != 0) fprintf(stderr, "Unknown DARKNET_SIMD %s, going with auto detection\n", env);
+    }
+
+    memset(&simd, 0, sizeof(simd));
+    simd.level = SIMD_GENERIC;
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    cpu_feature.sse4 = __builtin_cpu_supports("sse4.2") != 0;
+    cpu_feature.avx2 = __builtin_cpu_supports("avx2") != 0;
+    cpu_feature.fma = __builtin_cpu_supports("fma") != 0;
+    cpu_feature.avx512 = __builtin_cpu_supports("avx512f") != 0;
+
+    if(cpu_feature.sse4 && max >= SIMD_SSE4){
+        simd.level = SIMD_SSE4;
+    }
+    if(cpu_feature.avx2 && cpu_feature.fma && max >= SIMD_AVX2){
+        simd.level = SIMD_AVX2;
+        simd.gemm_mr = 6;
+        simd.gemm_nr = 16;
+        simd.gemm_kernel = gemm_kernel_avx2;
+        simd.axpy = axpy_avx2;
+        simd.scal = scal_avx2;
+        simd.normalize = normalize_avx2;
+        simd.sum = sum_avx2;
+        simd.sum_sq_diff = sum_sq_diff_avx2;
+        simd.activate = activate_avx2;
+        simd.box_iou = box_iou_avx2;
+    }
+    if(cpu_feature.avx512 && cpu_feature.avx2 && cpu_feature.fma && max >= SIMD_AVX512){
+        simd.level = SIMD_AVX512;
+        simd.gemm_mr = 8;
+        simd.gemm_nr = 32;
+        simd.gemm_kernel = gemm_kernel_avx512;
+        simd.axpy = axpy_avx512;
+        simd.scal = scal_avx512;
+        simd.normalize = normalize_avx512;
+        simd.sum = sum_avx512;
+        simd.sum_sq_diff = sum_sq_diff_avx512;
+        simd.activate = activate_avx512;
+    }
+#endif
+}
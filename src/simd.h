@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "darknet.h"
+#include "gemm.h"
+
+// gemm 微内核可能的最大子块，用于宏内核边缘处的临时子块
+#define SIMD_MAX_MR 8
+#define SIMD_MAX_NR 32
+
+typedef enum{
+    SIMD_GENERIC, SIMD_SSE4, SIMD_AVX2, SIMD_AVX512
+} SIMD_LEVEL;
+
+typedef struct{
+    int sse4;
+    int avx2;
+    int fma;
+    int avx512;
+} cpu_features;
+
+/*
+运行时根据CPU特性选择的函数表，在 simd_init() 中填充。
+为 0 的函数指针表示没有对应的向量化实现，调用方使用原来的标量循环。
+*/
+typedef struct{
+    SIMD_LEVEL level;
+    int gemm_mr;     // gemm 微内核一次计算的C子块行数
+    int gemm_nr;     // gemm 微内核一次计算的C子块列数
+    // accumulate 为0时 C = a*b，否则 C += a*b；ep 不为0时写回前做尾处理，ep 中的指针已经偏移到子块的第一行
+    void (*gemm_kernel)(int kc, float *a, float *b, float *c, int ldc, int accumulate, const gemm_epilogue *ep);
+    void (*axpy)(int n, float ALPHA, float *X, float *Y);
+    void (*scal)(int n, float ALPHA, float *X);
+    void (*normalize)(float *x, float mean, float stddev, int n);
+    float (*sum)(float *x, int n);
+    float (*sum_sq_diff)(float *x, float mean, int n);
+    int (*activate)(float *x, int n, ACTIVATION a);
+    // 框 a(left,right,top,bottom,面积)与 n 个框的 IoU，n 个框的各项分开存放，结果与 box_iou 逐位相同
+    void (*box_iou)(const float *a, int n, const float *left, const float *right, const float *top, const float *bot, const float *area, float *iou);
+} simd_ops;
+
+extern cpu_features cpu_feature;
+extern simd_ops simd;
+
+void simd_init();
+char *get_simd_string(SIMD_LEVEL level);
+
+#endif
@@ -8,7 +8,7 @@
 #include <stdio.h>
 #include <assert.h>
 
-softmax_layer make_softmax_layer(int batch, int inputs, int groups)
+softmax_layer make_softmax_layer(int batch, int inputs, int groups, int inference)
 {
     assert(inputs%groups == 0);
     fprintf(stderr, "softmax                                        %4d\n",  inputs);
@@ -20,7 +20,7 @@ softmax_layer make_softmax_layer(int batch, int inputs, int groups)
     l.outputs = inputs;
     l.loss = calloc(inputs*batch, sizeof(float));
     l.output = calloc(inputs*batch, sizeof(float));
-    l.delta = calloc(inputs*batch, sizeof(float));
+    if(!inference) l.delta = calloc(inputs*batch, sizeof(float));
     l.cost = calloc(1, sizeof(float));
 
     l.forward = forward_softmax_layer;
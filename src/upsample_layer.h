@@ -2,7 +2,7 @@
 #define UPSAMPLE_LAYER_H
 #include "darknet.h"
 
-layer make_upsample_layer(int batch, int w, int h, int c, int stride);
+layer make_upsample_layer(int batch, int w, int h, int c, int stride, int inference);
 void forward_upsample_layer(const layer l, network net);
 void backward_upsample_layer(const layer l, network net);
 void resize_upsample_layer(layer *l, int w, int h);
@@ -0,0 +1,294 @@
+#include "winograd.h"
+#include "gemm.h"
+#include "cuda.h"
+
+#include <stdlib.h>
+
+/*
+Winograd 最小滤波算法 F(mxm,3x3)，参考 Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks"。
+每个 (m+2)x(m+2) 的输入块 d 与 3x3 卷积核 g 的输出为 Y = A^T [(G g G^T) .* (B^T d B)] A，
+F(2x2,3x3) 每个输出点需要 16/4 = 4 次乘法，F(4x4,3x3) 需要 36/16 = 2.25 次，直接卷积需要 9 次。
+把所有输入通道、所有输出块的逐元素乘法按 (m+2)^2 个位置分别组织成矩阵乘法，就可以直接复用 gemm。
+*/
+
+static const float winograd_bt2[4*4] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1
+};
+static const float winograd_g2[4*3] = {
+    1,    0,   0,
+    .5,  .5,  .5,
+    .5, -.5,  .5,
+    0,    0,   1
+};
+static const float winograd_at2[2*4] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1
+};
+
+static const float winograd_bt4[6*6] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1
+};
+static const float winograd_g4[6*3] = {
+    1./4,     0,       0,
+    -1./6,  -1./6,  -1./6,
+    -1./6,   1./6,  -1./6,
+    1./24,   1./12,  1./6,
+    1./24,  -1./12,  1./6,
+    0,        0,       1
+};
+static const float winograd_at4[4*6] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1
+};
+
+static void get_winograd_matrices(int m, const float **bt, const float **g, const float **at)
+{
+    if(m == WINOGRAD_F4){
+        *bt = winograd_bt4;
+        *g = winograd_g4;
+        *at = winograd_at4;
+    } else {
+        *bt = winograd_bt2;
+        *g = winograd_g2;
+        *at = winograd_at2;
+    }
+}
+
+/*
+输入：卷积层 l，输出块大小 m
+功能：判断卷积层能否使用 F(mxm,3x3) 计算：3x3 卷积核、步长为1、不分组，且不是二值化网络
+返回：可以使用返回1，否则返回0
+*/
+int winograd_supported(layer l, int m)
+{
+#ifdef GPU
+    if(gpu_index >= 0) return 0;
+#endif
+    if(m != WINOGRAD_F2 && m != WINOGRAD_F4) return 0;
+    return l.size == 3 && l.stride == 1 && l.groups == 1 && !l.binary && !l.xnor;
+}
+
+/*
+输入：卷积层 l，输出块大小 m，工作空间的上限 limit(字节)
+功能：自动选择Winograd时的内存上限：该层支持 F(mxm,3x3)，并且所需的工作空间不超过 limit。
+     输入通道少、输出通道多的层(例如网络的第一层)变换后的输入和乘积比im2col矩阵大很多倍，这样的层仍然使用im2col
+返回：可以使用返回1，否则返回0
+*/
+int winograd_fits_workspace(layer l, int m, size_t limit)
+{
+    if(!winograd_supported(l, m)) return 0;
+    l.winograd = m;
+    return get_winograd_workspace_size(l) <= limit;
+}
+
+/*
+输入：卷积层 l
+功能：计算 forward_winograd_cpu 所需的工作空间大小，包括变换后的输入 V 和逐位置矩阵乘法的结果 M
+返回：所需的字节数
+*/
+size_t get_winograd_workspace_size(layer l)
+{
+    int t = l.winograd + 2;
+    size_t tiles = (size_t)((l.out_h + l.winograd - 1)/l.winograd) * ((l.out_w + l.winograd - 1)/l.winograd);
+    return (size_t)t*t*(l.c + l.n)*tiles*sizeof(float);
+}
+
+/*
+输入：卷积层 l，输出块大小 m（为0或者该层不支持时关闭Winograd）
+功能：为卷积层分配变换后的卷积核 l.winograd_weights，并根据当前的 l.weights 计算一次变换
+输出：l->winograd, l->winograd_weights
+*/
+void make_winograd_weights(layer *l, int m)
+{
+    if(!winograd_supported(*l, m)) m = 0;
+    if(l->winograd_weights) free(l->winograd_weights);
+    l->winograd_weights = 0;
+    l->winograd = m;
+    if(!m) return;
+    l->winograd_weights = calloc((size_t)(m+2)*(m+2)*l->n*l->c, sizeof(float));
+    transform_winograd_weights(*l);
+}
+
+/*
+输入：卷积层 l
+功能：计算 U = G g G^T，结果按 (m+2)^2 个位置存放，每个位置是一个 l.n x l.c 的矩阵，
+     作为 forward_winograd_cpu 中 gemm 的 A 矩阵。l.weights 改变之后（加载权重、更新权重）需要重新调用
+输出：l.winograd_weights
+*/
+void transform_winograd_weights(layer l)
+{
+    if(!l.winograd) return;
+    const float *bt, *G, *at;
+    get_winograd_matrices(l.winograd, &bt, &G, &at);
+    int t = l.winograd + 2;
+    int nc = l.n*l.c;
+    int f;
+    #pragma omp parallel for
+    for(f = 0; f < nc; ++f){
+        const float *g = l.weights + f*9;
+        float tmp[6*3];
+        int i, j, r;
+        for(i = 0; i < t; ++i){
+            for(j = 0; j < 3; ++j){
+                float sum = 0;
+                for(r = 0; r < 3; ++r) sum += G[i*3 + r]*g[r*3 + j];
+                tmp[i*3 + j] = sum;
+            }
+        }
+        for(i = 0; i < t; ++i){
+            for(j = 0; j < t; ++j){
+                float sum = 0;
+                for(r = 0; r < 3; ++r) sum += tmp[i*3 + r]*G[j*3 + r];
+                l.winograd_weights[(size_t)(i*t + j)*nc + f] = sum;
+            }
+        }
+    }
+}
+
+/*
+输入：变换矩阵 bt（t x t），输入块 d（t x t），块大小 t
+功能：计算 B^T d B，结果写入 v 中第 i*t+j 个位置，位置之间的间隔为 stride
+说明：t 在调用处为常数，内联后循环完全展开，变换矩阵中的 0 和 1 也会被编译器化简
+*/
+static inline void winograd_input_tile(const float *bt, int t, float *d, float *v, size_t stride)
+{
+    float tmp[6*6];
+    int i, j, r;
+    for(i = 0; i < t; ++i){
+        for(j = 0; j < t; ++j){
+            float sum = 0;
+            for(r = 0; r < t; ++r) sum += bt[i*t + r]*d[r*t + j];
+            tmp[i*t + j] = sum;
+        }
+    }
+    for(i = 0; i < t; ++i){
+        for(j = 0; j < t; ++j){
+            float sum = 0;
+            for(r = 0; r < t; ++r) sum += tmp[i*t + r]*bt[j*t + r];
+            v[(i*t + j)*stride] = sum;
+        }
+    }
+}
+
+/*
+输入：变换矩阵 at（m x t），逐位置乘法的结果 mm（t x t），块大小 t，输出块大小 m
+功能：计算 A^T mm A，结果为 m x m 的输出块 y
+*/
+static inline void winograd_output_tile(const float *at, int t, int m, float *mm, float *y)
+{
+    float tmp[4*6];
+    int i, j, r;
+    for(i = 0; i < m; ++i){
+        for(j = 0; j < t; ++j){
+            float sum = 0;
+            for(r = 0; r < t; ++r) sum += at[i*t + r]*mm[r*t + j];
+            tmp[i*t + j] = sum;
+        }
+    }
+    for(i = 0; i < m; ++i){
+        for(j = 0; j < m; ++j){
+            float sum = 0;
+            for(r = 0; r < t; ++r) sum += tmp[i*t + r]*at[j*t + r];
+            y[i*m + j] = sum;
+        }
+    }
+}
+
+/*
+输入：卷积层 l，
+     单个样本的输入 im（l.c x l.h x l.w），
+     工作空间 workspace，大小至少为 get_winograd_workspace_size(l)，
+     单个样本的输出 output（l.n x l.out_h x l.out_w）
+     *ep 尾处理，为0时不做，每个输出通道对应一行
+功能：用 Winograd F(mxm,3x3) 完成单个样本的卷积，结果直接写入 output（不累加），
+     每个输出通道在输出变换写完之后立即做尾处理，此时该通道的输出还在缓存中
+输出：output
+*/
+void forward_winograd_cpu(layer l, float *im, float *workspace, float *output, const gemm_epilogue *ep)
+{
+    int m = l.winograd;
+    int t = m + 2;
+    int tiles_h = (l.out_h + m - 1)/m;
+    int tiles_w = (l.out_w + m - 1)/m;
+    int tiles = tiles_h*tiles_w;
+    size_t vstride = (size_t)l.c*tiles;
+    size_t mstride = (size_t)l.n*tiles;
+    float *V = workspace;               // (m+2)^2 个 l.c x tiles 的矩阵
+    float *M = workspace + (size_t)t*t*vstride;  // (m+2)^2 个 l.n x tiles 的矩阵
+    int ci, k, xi;
+
+    // 输入变换 V = B^T d B，超出输入范围的部分按补零处理
+    #pragma omp parallel for
+    for(ci = 0; ci < l.c; ++ci){
+        float *in = im + (size_t)ci*l.h*l.w;
+        float d[6*6];
+        int th, tw, i, j;
+        for(th = 0; th < tiles_h; ++th){
+            int row0 = th*m - l.pad;
+            for(tw = 0; tw < tiles_w; ++tw){
+                int col0 = tw*m - l.pad;
+                if(row0 >= 0 && col0 >= 0 && row0 + t <= l.h && col0 + t <= l.w){
+                    for(i = 0; i < t; ++i){
+                        for(j = 0; j < t; ++j) d[i*t + j] = in[(row0 + i)*l.w + col0 + j];
+                    }
+                } else {
+                    for(i = 0; i < t; ++i){
+                        int row = row0 + i;
+                        for(j = 0; j < t; ++j){
+                            int col = col0 + j;
+                            d[i*t + j] = (row < 0 || col < 0 || row >= l.h || col >= l.w) ? 0 : in[row*l.w + col];
+                        }
+                    }
+                }
+                float *v = V + (size_t)ci*tiles + th*tiles_w + tw;
+                if(m == WINOGRAD_F4) winograd_input_tile(winograd_bt4, 6, d, v, vstride);
+                else winograd_input_tile(winograd_bt2, 4, d, v, vstride);
+            }
+        }
+    }
+
+    // 每个位置上的逐元素乘法并对输入通道求和，即 M[xi] = U[xi] * V[xi]
+    for(xi = 0; xi < t*t; ++xi){
+        float *a = l.winograd_weights + (size_t)xi*l.n*l.c;
+        float *b = V + (size_t)xi*vstride;
+        float *c = M + (size_t)xi*mstride;
+        gemm(0,0,l.n,tiles,l.c,1,a,l.c,b,tiles,0,c,tiles);
+    }
+
+    // 输出变换 Y = A^T M A，只写回在输出范围内的部分
+    #pragma omp parallel for
+    for(k = 0; k < l.n; ++k){
+        float *out = output + (size_t)k*l.out_h*l.out_w;
+        float mm[6*6], y[4*4];
+        int th, tw, i, j;
+        for(th = 0; th < tiles_h; ++th){
+            for(tw = 0; tw < tiles_w; ++tw){
+                float *src = M + (size_t)k*tiles + th*tiles_w + tw;
+                for(i = 0; i < t*t; ++i) mm[i] = src[i*mstride];
+                if(m == WINOGRAD_F4) winograd_output_tile(winograd_at4, 6, 4, mm, y);
+                else winograd_output_tile(winograd_at2, 4, 2, mm, y);
+                for(i = 0; i < m && th*m + i < l.out_h; ++i){
+                    for(j = 0; j < m && tw*m + j < l.out_w; ++j){
+                        out[(th*m + i)*l.out_w + tw*m + j] = y[i*m + j];
+                    }
+                }
+            }
+        }
+        if(ep){
+            gemm_epilogue e = *ep;
+            if(e.scales) e.scales += k;
+            if(e.biases) e.biases += k;
+            gemm_apply_epilogue(out, l.out_h*l.out_w, 1, l.out_h*l.out_w, &e);
+        }
+    }
+}
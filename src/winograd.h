@@ -0,0 +1,18 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "darknet.h"
+#include "gemm.h"
+
+// 目前支持的输出块大小：F(2x2,3x3) 与 F(4x4,3x3)
+#define WINOGRAD_F2 2
+#define WINOGRAD_F4 4
+
+int winograd_supported(layer l, int m);
+int winograd_fits_workspace(layer l, int m, size_t limit);
+size_t get_winograd_workspace_size(layer l);
+void make_winograd_weights(layer *l, int m);
+void transform_winograd_weights(layer l);
+void forward_winograd_cpu(layer l, float *im, float *workspace, float *output, const gemm_epilogue *ep);
+
+#endif
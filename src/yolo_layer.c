@@ -10,7 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes)
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int inference)
 {
     int i;
     layer l = {0};
@@ -39,7 +39,7 @@ layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int
     l.outputs = h*w*n*(classes + 4 + 1);
     l.inputs = l.outputs;
     l.truths = 90*(4 + 1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(!inference) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     for(i = 0; i < total*2; ++i){
         l.biases[i] = .5;
@@ -69,7 +69,7 @@ void resize_yolo_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -145,8 +145,8 @@ void forward_yolo_layer(const layer l, network net)
     }
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     float avg_iou = 0;
     float recall = 0;
     float recall75 = 0;
@@ -244,7 +244,8 @@ void backward_yolo_layer(const layer l, network net)
    axpy_cpu(l.batch*l.inputs, 1, l.delta, 1, net.delta, 1);
 }
 
-void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative)
+// 把按网络输入(letterbox之后)计算的检测框还原到原图，relative 为0时换算成像素
+static void correct_yolo_box_array(box *boxes, int n, int w, int h, int netw, int neth, int relative)
 {
     int i;
     int new_w=0;
@@ -257,7 +258,7 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
         new_w = (w * neth)/h;
     }
     for (i = 0; i < n; ++i){
-        box b = dets[i].bbox;
+        box b = boxes[i];
         b.x =  (b.x - (netw - new_w)/2./netw) / ((float)new_w/netw); 
         b.y =  (b.y - (neth - new_h)/2./neth) / ((float)new_h/neth); 
         b.w *= (float)netw/new_w;
@@ -268,7 +269,15 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
             b.y *= h;
             b.h *= h;
         }
-        dets[i].bbox = b;
+        boxes[i] = b;
+    }
+}
+
+void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative)
+{
+    int i;
+    for (i = 0; i < n; ++i){
+        correct_yolo_box_array(&dets[i].bbox, 1, w, h, netw, neth, relative);
     }
 }
 
@@ -313,32 +322,69 @@ void avg_flipped_yolo(layer l)
     }
 }
 
-int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets)
+/*
+输入：YOLO层 l，阈值 thresh，候选位置的缓冲 candidates（至少 l.w*l.h*l.n 个）
+功能：只扫描一遍 objectness，记下超过阈值的位置(n*l.w*l.h + i)，顺序与 get_yolo_detections 相同(先位置后anchor)
+返回：候选位置的个数
+*/
+int yolo_candidates(layer l, float thresh, int *candidates)
 {
-    int i,j,n;
-    float *predictions = l.output;
-    if (l.batch == 2) avg_flipped_yolo(l);
+    int i, n;
     int count = 0;
+    int stride = l.w*l.h*(4 + l.classes + 1);
+    float *obj = l.output + 4*l.w*l.h;
     for (i = 0; i < l.w*l.h; ++i){
-        int row = i / l.w;
-        int col = i % l.w;
         for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            float objectness = predictions[obj_index];
-            if(objectness <= thresh) continue;
-            int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
-            dets[count].bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, col, row, l.w, l.h, netw, neth, l.w*l.h);
-            dets[count].objectness = objectness;
-            dets[count].classes = l.classes;
-            for(j = 0; j < l.classes; ++j){
-                int class_index = entry_index(l, 0, n*l.w*l.h + i, 4 + 1 + j);
-                float prob = objectness*predictions[class_index];
-                dets[count].prob[j] = (prob > thresh) ? prob : 0;
-            }
-            ++count;
+            if(obj[n*stride + i] > thresh) candidates[count++] = n*l.w*l.h + i;
         }
     }
+    return count;
+}
+
+// 解码位置 location 上的检测框、objectness 和各个类别的概率(低于阈值的置为0)
+static void yolo_candidate_detection(layer l, int location, int netw, int neth, float thresh, box *b, float *objectness, float *prob)
+{
+    int j;
+    int plane = l.w*l.h;
+    int n = location / plane;
+    int i = location % plane;
+    int box_index = entry_index(l, 0, location, 0);
+    float obj = l.output[box_index + 4*plane];
+    float *p = l.output + box_index + 5*plane;
+    *b = get_yolo_box(l.output, l.biases, l.mask[n], box_index, i % l.w, i / l.w, l.w, l.h, netw, neth, plane);
+    *objectness = obj;
+    for(j = 0; j < l.classes; ++j){
+        float pr = obj*p[j*plane];
+        prob[j] = (pr > thresh) ? pr : 0;
+    }
+}
+
+/*
+输入：YOLO层 l，候选位置 candidates 和个数 count（yolo_candidates 的结果），原图大小 w,h，网络输入大小 netw,neth
+功能：只对候选位置解码，检测框按 relative 还原到原图
+输出：boxes、objectness 的前 count 个，以及 prob 的前 count 行(每行 l.classes 个)
+*/
+void get_yolo_candidate_detections(layer l, int *candidates, int count, int w, int h, int netw, int neth, float thresh, int relative, box *boxes, float *objectness, float *prob)
+{
+    int k;
+    for(k = 0; k < count; ++k){
+        yolo_candidate_detection(l, candidates[k], netw, neth, thresh, boxes + k, objectness + k, prob + (size_t)k*l.classes);
+    }
+    correct_yolo_box_array(boxes, count, w, h, netw, neth, relative);
+}
+
+int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets)
+{
+    int k;
+    if (l.batch == 2) avg_flipped_yolo(l);
+    int *candidates = calloc(l.w*l.h*l.n, sizeof(int));
+    int count = yolo_candidates(l, thresh, candidates);
+    for(k = 0; k < count; ++k){
+        yolo_candidate_detection(l, candidates[k], netw, neth, thresh, &dets[k].bbox, &dets[k].objectness, dets[k].prob);
+        dets[k].classes = l.classes;
+    }
     correct_yolo_boxes(dets, count, w, h, netw, neth, relative);
+    free(candidates);
     return count;
 }
 
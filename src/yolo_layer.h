@@ -5,11 +5,14 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes);
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int inference);
 void forward_yolo_layer(const layer l, network net);
 void backward_yolo_layer(const layer l, network net);
 void resize_yolo_layer(layer *l, int w, int h);
 int yolo_num_detections(layer l, float thresh);
+void avg_flipped_yolo(layer l);
+int yolo_candidates(layer l, float thresh, int *candidates);
+void get_yolo_candidate_detections(layer l, int *candidates, int count, int w, int h, int netw, int neth, float thresh, int relative, box *boxes, float *objectness, float *prob);
 
 #ifdef GPU
 void forward_yolo_layer_gpu(const layer l, network net);